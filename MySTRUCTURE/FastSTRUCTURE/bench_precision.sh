@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# Builds vb once per storage / accumulation precision, runs the same fixed-length fit with each
+# and reports the run time and the drift of the LLBO and Q from the double / double reference.
+#
+# Usage: ./bench_precision.sh <genotype-file> [K] [iterations] [extra vb options]
+
+if [ $# -lt 1 ]
+then
+	echo "Usage: $0 <genotype-file> [K] [iterations] [extra vb options]"
+	exit 1
+fi
+
+IN_FILE=$(realpath "$1")
+K=${2:-2}
+ITERS=${3:-50}
+shift $(( $# < 3 ? $# : 3 ))
+EXTRA_OPTS="$@"
+
+SRC_DIR=$(dirname "$(realpath "$0")")
+BENCH_DIR=$SRC_DIR/bench_precision
+
+# name : compile definitions
+CONFIGS=(
+	"double/double:-DUSE_DOUBLE_PRECISION"
+	"double/Kahan:-DUSE_DOUBLE_PRECISION -DUSE_KAHAN_SUMMATION"
+	"float/float:-DUSE_FLOAT_ACCUMULATION"
+	"float/double:"
+	"float/Kahan:-DUSE_KAHAN_SUMMATION"
+)
+
+mkdir -p "$BENCH_DIR"
+for CONFIG in "${CONFIGS[@]}"
+do
+	NAME=${CONFIG%%:*}
+	DIR=$BENCH_DIR/${NAME//\//_}
+	echo Building $NAME . . .
+	cmake -S "$SRC_DIR" -B "$DIR" -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_FLAGS="${CONFIG#*:}" > /dev/null && \
+		cmake --build "$DIR" -j"$(nproc)" > /dev/null || exit 2
+
+	echo Running $NAME . . .
+	(cd "$DIR" && ./vb "$IN_FILE" --sweep $K $K --seed 1 --epsilon 0 --min-iters $ITERS --max-iters $ITERS $EXTRA_OPTS > /dev/null) || exit 3
+done
+
+# sweep.txt: K LLBO LLBO_PER_GENO ITERS CONVERGED SECONDS ...;  props_K<K>.txt: index Q_1 .. Q_K ...
+REF_DIR=$BENCH_DIR/double_double
+echo
+printf "%-16s %10s %22s %14s %12s\n" STORAGE/ACCUM SECONDS LLBO LLBO_REL_DRIFT Q_MAX_DRIFT
+for CONFIG in "${CONFIGS[@]}"
+do
+	NAME=${CONFIG%%:*}
+	DIR=$BENCH_DIR/${NAME//\//_}
+	read RUN_SECONDS LLBO LLBO_DRIFT <<< $(awk 'FNR == 2 { if (NR == FNR) ref = $2; else print $6, $2, ($2 - ref) / (ref < 0 ? -ref : ref) }' \
+		"$REF_DIR/sweep.txt" "$DIR/sweep.txt")
+	Q_DRIFT=$(awk -v K=$K 'NR == FNR { for (k = 2; k <= K + 1; ++k) ref[FNR, k] = $k; next }
+		{ for (k = 2; k <= K + 1; ++k) { d = $k - ref[FNR, k]; if (d < 0) d = -d; if (d > mx) mx = d } }
+		END { printf "%.3g", mx }' "$REF_DIR/props_K$K.txt" "$DIR/props_K$K.txt")
+	printf "%-16s %10.3f %22.15g %14.3g %12s\n" $NAME $RUN_SECONDS $LLBO $LLBO_DRIFT $Q_DRIFT
+done
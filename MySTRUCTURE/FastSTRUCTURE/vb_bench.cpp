@@ -0,0 +1,341 @@
+// Microbenchmarks of the VB kernels on synthetic genotypes made in the process, over a sweep of (N, L, K).
+// The kernels come from vb_kernels.cpp, the same object as in vb, built with the same precision and summation flags.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+#include "mapped-genos.h"
+#include "text-genos.h"
+#include "thread-pool.h"
+#include "vb_kernels.h"
+
+// Defaults of the size sweep, every combination of them is benchmarked.
+static const std::vector<int> BENCH_NUM_INDIVS = { 500, 2000 };
+static const std::vector<int> BENCH_NUM_LOCI = { 1000, 4000 };
+static const std::vector<int> BENCH_NUM_CLUSTERS = { 2, 4 };
+
+static constexpr int BENCH_REPS = 5;
+
+// Sizes whose stored Z is larger than this many MB skip the kernels of the stored Z.
+static constexpr int BENCH_MAX_Z_MB = 2048;
+
+static const std::string DUMP_PATH =
+#if defined __linux__ || defined __CYGWIN__
+	"";
+#else
+	"F:\\C++\\MySTRUCTURE\\";
+#endif
+
+static const std::string BENCH_CSV_PATH = DUMP_PATH + "bench.csv";
+static const std::string BENCH_TEXT_PATH = DUMP_PATH + "bench_genos.txt";
+static const std::string BENCH_PACKED_PATH = DUMP_PATH + "bench_genos.bin";
+
+struct BenchOptions
+{
+	BenchOptions()
+		: num_indivs(BENCH_NUM_INDIVS), num_loci(BENCH_NUM_LOCI), num_clusters(BENCH_NUM_CLUSTERS)
+		, reps(BENCH_REPS), num_threads(0), seed(1), max_z_mb(BENCH_MAX_Z_MB), csv_path(BENCH_CSV_PATH)
+	{}
+
+	std::vector<int> num_indivs;
+	std::vector<int> num_loci;
+	std::vector<int> num_clusters;
+	int reps;
+	int num_threads;
+	uint64_t seed;
+	int max_z_mb;
+	std::string csv_path;
+	std::string label;		// Free text of the CSV rows, e.g. the commit, to tell runs apart.
+};
+
+/// Wall times of the repetitions of one kernel in ms.
+struct BenchStats
+{
+	BenchStats() : min(0), median(0), mean(0), stddev(0), max(0) {}
+
+	double min;
+	double median;
+	double mean;
+	double stddev;
+	double max;
+};
+
+static void PrintBenchUsage(const char* exe_name)
+{
+	logger << "Usage: " << exe_name << " [--n N1,N2,..] [--l L1,L2,..] [--k K1,K2,..] [--reps R] [--threads T] [--seed S]"
+		<< " [--max-z-mb M] [--csv PATH] [--label TEXT]" << std::endl;
+	logger << "  Times P, Z and Q updates, the LLBO and the text and packed genotype loaders on synthetic genotypes" << std::endl;
+	logger << "  of every combination of N, L and K, and appends the statistics of the repetitions to a CSV file." << std::endl;
+	logger << "  --n, --l, --k  Comma separated sizes of the sweep (default: 500,2000  1000,4000  2,4)." << std::endl;
+	logger << "  --reps R       Timed repetitions of each kernel after one warm-up run (default: " << BENCH_REPS << ")." << std::endl;
+	logger << "  --threads T    Number of worker threads (default: all hardware threads)." << std::endl;
+	logger << "  --seed S       Seed of the synthetic genotypes and of the initial Z (default: 1)." << std::endl;
+	logger << "  --max-z-mb M   Skip the stored Z kernels of sizes whose Z is larger (default: " << BENCH_MAX_Z_MB << ")." << std::endl;
+	logger << "  --csv PATH     CSV file the rows are appended to, with a header if it is new (default: bench.csv)." << std::endl;
+	logger << "  --label TEXT   Label of the rows, e.g. $(git rev-parse --short HEAD), to compare commits." << std::endl;
+}
+
+static bool ParseSizes(const char* arg, std::vector<int>& sizes)
+{
+	sizes.clear();
+	std::istringstream stream(arg);
+	std::string token;
+	while (std::getline(stream, token, ',')) {
+		const int SIZE = std::atoi(token.c_str());
+		if (SIZE < 1)
+			return false;
+		sizes.push_back(SIZE);
+	}
+	return !sizes.empty();
+}
+
+static bool ParseBenchOptions(int argc, char** argv, BenchOptions& opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		const std::string ARG = argv[i];
+		bool is_ok = true;
+		if (ARG == "--n" && i + 1 < argc)
+			is_ok = ParseSizes(argv[++i], opts.num_indivs);
+		else if (ARG == "--l" && i + 1 < argc)
+			is_ok = ParseSizes(argv[++i], opts.num_loci);
+		else if (ARG == "--k" && i + 1 < argc)
+			is_ok = ParseSizes(argv[++i], opts.num_clusters);
+		else if (ARG == "--reps" && i + 1 < argc)
+			opts.reps = std::max(1, std::atoi(argv[++i]));
+		else if (ARG == "--threads" && i + 1 < argc)
+			opts.num_threads = std::atoi(argv[++i]);
+		else if (ARG == "--seed" && i + 1 < argc)
+			opts.seed = std::strtoull(argv[++i], nullptr, 10);
+		else if (ARG == "--max-z-mb" && i + 1 < argc)
+			opts.max_z_mb = std::atoi(argv[++i]);
+		else if (ARG == "--csv" && i + 1 < argc)
+			opts.csv_path = argv[++i];
+		else if (ARG == "--label" && i + 1 < argc)
+			opts.label = argv[++i];
+		else
+			is_ok = false;
+		if (!is_ok) {
+			logger << "Invalid argument `" << ARG << "'!" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Genotypes of K populations without admixture, individual n from population n % K, N rounded up to a
+/// multiple of K as in a -faststr.txt file. The allele frequencies of a population are uniform in
+/// [0.05, 0.95] and the genotypes in Hardy-Weinberg equilibrium.
+static void MakeBenchGenos(int num_indivs, int num_loci, int num_clusters, uint64_t seed, BitGenosMatrix& genos)
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> unif(0, 1);
+	std::vector<double> freqs(static_cast<size_t>(num_loci) * num_clusters);
+	for (double& f : freqs)
+		f = 0.05 + 0.9 * unif(rng);
+
+	genos.Init((num_indivs + num_clusters - 1) / num_clusters, num_loci, num_clusters);
+	for (int n = 0; n < genos.GetNumIndivs(); ++n)
+		for (int l = 0; l < num_loci; ++l) {
+			const double F = freqs[static_cast<size_t>(l) * num_clusters + n % num_clusters];
+			genos.SetGeno(n, l, (unif(rng) < F) + (unif(rng) < F));
+		}
+}
+
+/// Runs `func' `reps' timed times, the caches must be warm already.
+template <typename Func>
+static BenchStats TimeRuns(int reps, const Func& func)
+{
+	std::vector<double> ms(reps);
+	for (int r = 0; r < reps; ++r) {
+		const auto START = std::chrono::steady_clock::now();
+		func();
+		ms[r] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - START).count();
+	}
+
+	BenchStats stats;
+	std::sort(ms.begin(), ms.end());
+	stats.min = ms.front();
+	stats.max = ms.back();
+	stats.median = reps % 2 ? ms[reps / 2] : (ms[reps / 2 - 1] + ms[reps / 2]) / 2;
+	stats.mean = std::accumulate(ms.begin(), ms.end(), 0.0) / reps;
+	double sm_sq = 0.0;
+	for (double t : ms)
+		sm_sq += (t - stats.mean) * (t - stats.mean);
+	stats.stddev = reps > 1 ? std::sqrt(sm_sq / (reps - 1)) : 0.0;
+	return stats;
+}
+
+/// Runs `func' once to warm the caches up, then `reps' timed times.
+template <typename Func>
+static BenchStats TimeKernel(int reps, const Func& func)
+{
+	func();
+	return TimeRuns(reps, func);
+}
+
+/// Appends the rows of one run to the CSV file, after a header if the file is new.
+class BenchCsv
+{
+public:
+	inline bool Open(const std::string& path)
+	{
+		const bool IS_NEW = !std::ifstream(path).is_open();
+		file.open(path, std::ios_base::app);
+		if (!file.is_open())
+			return false;
+		if (IS_NEW)
+			file << "label,kernel,num_indivs,num_loci,num_clusters,num_threads,float_type,accumulation,reps,"
+				"min_ms,median_ms,mean_ms,stddev_ms,max_ms,elems_per_s" << std::endl;
+		return true;
+	}
+
+	/// `num_elems' is what the kernel visits, N L K for the VB kernels, N L for the loaders and L K or N K for the
+	/// expectations; elems_per_s is per median time.
+	inline void Write(const BenchOptions& opts, const char* kernel, const BitGenosMatrix& genos, int num_threads,
+		double num_elems, const BenchStats& stats)
+	{
+		char buf[256];
+		snprintf(buf, sizeof(buf), ",%s,%d,%d,%d,%d,%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.6g", kernel,
+			genos.GetNumIndivs(), genos.GetNumLoci(), genos.GetNumClusters(), num_threads,
+			sizeof(FloatType) == sizeof(double) ? "double" : "float", GetAccumulationName(), opts.reps,
+			stats.min, stats.median, stats.mean, stats.stddev, stats.max,
+			stats.median > 0 ? num_elems / (stats.median / 1e3) : 0.0);
+		file << opts.label << buf << std::endl;
+
+		logger << Time << "   " << kernel << std::string(std::max<size_t>(1, 20 - strlen(kernel)), ' ')
+			<< "median " << stats.median << " ms     min " << stats.min << "     max " << stats.max
+			<< "     sd " << stats.stddev << "     " << (stats.median > 0 ? num_elems / (stats.median / 1e3) : 0.0)
+			<< " elems/s" << std::endl;
+	}
+
+private:
+	std::ofstream file;
+};
+
+/// Benchmarks every kernel on genotypes of one size.
+static void RunBench(const BenchOptions& opts, int num_indivs, int num_loci, int num_clusters, int num_threads,
+	BenchCsv& csv)
+{
+	ThreadPool pool(num_threads);
+	BitGenosMatrix genos;
+	MakeBenchGenos(num_indivs, num_loci, num_clusters, opts.seed, genos);
+	num_indivs = genos.GetNumIndivs();
+	logger << Time << " N:" << num_indivs << "     L:" << num_loci << "     K:" << num_clusters << std::endl;
+	const double NUM_GENOS = static_cast<double>(num_indivs) * num_loci;
+	const double NUM_ELEMS = NUM_GENOS * num_clusters;
+
+	// Loaders, from the page cache once the warm-up run has read the file.
+	// The warm-up load is checked, so a failed load is not timed as a fast one.
+	if (genos.DumpText(BENCH_TEXT_PATH)) {
+		BitGenosMatrix loaded;
+		const auto LOAD_TEXT = [&]() { return TextGenosFile::ReadFastStructure(BENCH_TEXT_PATH, loaded, pool); };
+		if (LOAD_TEXT())
+			csv.Write(opts, "load_text", genos, num_threads, NUM_GENOS, TimeRuns(opts.reps, LOAD_TEXT));
+		else
+			logger << Time << ' ' << warning << " Could not read `" << BENCH_TEXT_PATH << "', load_text skipped!" << std::endl;
+		std::remove(BENCH_TEXT_PATH.c_str());
+	} else
+		logger << Time << ' ' << warning << " Could not write `" << BENCH_TEXT_PATH << "', load_text skipped!" << std::endl;
+
+	if (MappedGenosMatrix::Write(BENCH_PACKED_PATH, genos)) {
+		BitGenosMatrix loaded;
+		const auto LOAD_PACKED = [&]() {
+			MappedGenosMatrix mapped_genos;
+			if (!mapped_genos.Open(BENCH_PACKED_PATH) || !mapped_genos.Verify())
+				return false;
+			mapped_genos.CopyTo(loaded);
+			return true;
+		};
+		if (LOAD_PACKED())
+			csv.Write(opts, "load_packed", genos, num_threads, NUM_GENOS, TimeRuns(opts.reps, LOAD_PACKED));
+		else
+			logger << Time << ' ' << warning << " Could not read `" << BENCH_PACKED_PATH << "', load_packed skipped!" << std::endl;
+		std::remove(BENCH_PACKED_PATH.c_str());
+	} else
+		logger << Time << ' ' << warning << " Could not write `" << BENCH_PACKED_PATH << "', load_packed skipped!" << std::endl;
+
+	// The parameters after one stored iteration from a random Z, so every kernel sees a realistic state.
+	P p; p.Init(num_loci, num_clusters);
+	Q q; q.Init(num_indivs, num_clusters);
+	Expectations exps; exps.Init(num_indivs, num_loci, num_clusters);
+	p.Update(genos, RandomZ(num_indivs, num_loci, num_clusters, opts.seed), pool);
+	exps.UpdateP(p, pool);
+	exps.UpdateQ(q, pool);
+
+	csv.Write(opts, "exps_update_p", genos, num_threads, num_loci * static_cast<double>(num_clusters),
+		TimeKernel(opts.reps, [&]() { exps.UpdateP(p, pool); }));
+	csv.Write(opts, "exps_update_q", genos, num_threads, num_indivs * static_cast<double>(num_clusters),
+		TimeKernel(opts.reps, [&]() { exps.UpdateQ(q, pool); }));
+
+	const double Z_MB = NUM_ELEMS * NUM_CHROMOSOMES * sizeof(FloatType) / (1 << 20);
+	if (Z_MB <= opts.max_z_mb) {
+		Z z; z.Init(num_indivs, num_loci, num_clusters, opts.seed);
+		z.Update(genos, exps, pool);
+		q.Update(z, pool);
+		exps.UpdateQ(q, pool);
+
+		csv.Write(opts, "p_update", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() { p.Update(genos, z, pool); }));
+		csv.Write(opts, "z_update", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() { z.Update(genos, exps, pool); }));
+		csv.Write(opts, "q_update", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() { q.Update(z, pool); }));
+		csv.Write(opts, "llbo", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() {
+			CalculateLLBO(genos, z, q, p, exps, pool);
+		}));
+	} else
+		logger << Time << " Stored Z of " << Z_MB << " MB is over --max-z-mb, its kernels are skipped." << std::endl;
+
+	// The streamed Z of --stream, --accelerate and the mapped files.
+	const StreamedZ STREAMED_Z(genos, exps);
+	csv.Write(opts, "p_update_streamed", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() {
+		p.Update(genos, STREAMED_Z, pool);
+	}));
+	csv.Write(opts, "q_update_streamed", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() {
+		q.Update(STREAMED_Z, pool);
+	}));
+	csv.Write(opts, "llbo_streamed", genos, num_threads, NUM_ELEMS, TimeKernel(opts.reps, [&]() {
+		CalculateLLBO(genos, STREAMED_Z, q, p, exps, pool);
+	}));
+}
+
+int main(int argc, char** argv)
+{
+	logger << std::endl << std::endl;
+	logger << "===== VB BENCH =====" << std::endl;
+	logger << "Start : " << Time << std::endl;
+
+	BenchOptions opts;
+	if (!ParseBenchOptions(argc, argv, opts)) {
+		PrintBenchUsage(argv[0]);
+		return 1;
+	}
+
+	const int NUM_THREADS = opts.num_threads > 0 ? opts.num_threads : ThreadPool::GetHardwareThreads();
+	logger << "FLOAT TYPE   : " << (sizeof(FloatType) == sizeof(double) ? "double" : "float") << std::endl;
+	logger << "ACCUMULATION : " << GetAccumulationName() << std::endl;
+	logger << "SIMD MATH    : " << GetSimdInstructionSet() << " x" << GetSimdLanes() << std::endl;
+	logger << "NUM_THREADS  : " << NUM_THREADS << std::endl;
+	logger << "REPS         : " << opts.reps << std::endl;
+	logger << "CSV          : " << opts.csv_path << std::endl;
+	logger << std::endl;
+
+	BenchCsv csv;
+	if (!csv.Open(opts.csv_path)) {
+		logger << "Could not open `" << opts.csv_path << "' file!" << std::endl;
+		return 2;
+	}
+	for (int num_indivs : opts.num_indivs)
+		for (int num_loci : opts.num_loci)
+			for (int num_clusters : opts.num_clusters)
+				RunBench(opts, num_indivs, num_loci, num_clusters, NUM_THREADS, csv);
+
+	logger << "End : " << Time << std::endl << std::endl;
+	return 0;
+}
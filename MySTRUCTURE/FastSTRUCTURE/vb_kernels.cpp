@@ -0,0 +1,122 @@
+#include "vb_kernels.h"
+
+// Number of (l, k) elements passed to the SIMD math kernels at once when the P expectations are updated.
+static constexpr int EXPS_BLOCK_ELEMS = 1024;
+
+
+
+const char* GetAccumulationName()
+{
+#if defined(USE_KAHAN_SUMMATION)
+	return sizeof(FloatType) == sizeof(double) ? "double, Kahan" : "float, Kahan";
+#elif defined(USE_FLOAT_ACCUMULATION)
+	return sizeof(FloatType) == sizeof(double) ? "double" : "float";
+#else
+	return "double";
+#endif
+}
+
+
+
+void Expectations::UpdateP(const P& p, ThreadPool& pool)
+{
+	pool.ParallelFor(0, GetNumLoci(), [&](int first_locus, int last_locus) {
+		// The digammas, logs and exps of a block of loci go through the SIMD array kernels at once.
+		const int BLOCK_LOCI = std::max(1, EXPS_BLOCK_ELEMS / GetNumClusters());
+		std::vector<double> p_u(BLOCK_LOCI * GetNumClusters()), p_v(p_u.size()), p_uv(p_u.size());
+		std::vector<double> dg_u(p_u.size()), dg_v(p_u.size()), dg_uv(p_u.size());
+		for (int first_l = first_locus; first_l < last_locus; first_l += BLOCK_LOCI) {
+			const int LAST_L = std::min(last_locus, first_l + BLOCK_LOCI);
+			const int FIRST_IDX = GetPIdx(first_l, 0);
+			const int NUM_ELEMS = GetPIdx(LAST_L, 0) - FIRST_IDX;
+			for (int l = first_l, i = 0; l < LAST_L; ++l) {
+				for (int k = 0; k < GetNumClusters(); ++k, ++i) {
+					p_u[i] = p.GetFreq(l, k, 0);
+					p_v[i] = p.GetFreq(l, k, 1);
+					p_uv[i] = p_u[i] + p_v[i];
+				}
+			}
+
+			DigammaArray(p_u.data(), dg_u.data(), NUM_ELEMS);
+			DigammaArray(p_v.data(), dg_v.data(), NUM_ELEMS);
+			DigammaArray(p_uv.data(), dg_uv.data(), NUM_ELEMS);
+			for (int i = 0; i < NUM_ELEMS; ++i) {
+				log_p[FIRST_IDX + i] = dg_u[i] - dg_uv[i];
+				log_1_p[FIRST_IDX + i] = dg_v[i] - dg_uv[i];
+			}
+			ExpArray(&log_p[FIRST_IDX], dg_u.data(), NUM_ELEMS);
+			ExpArray(&log_1_p[FIRST_IDX], dg_v.data(), NUM_ELEMS);
+			for (int i = 0; i < NUM_ELEMS; ++i) {
+				exp_log_p[FIRST_IDX + i] = static_cast<FloatType>(dg_u[i]);
+				exp_log_1_p[FIRST_IDX + i] = static_cast<FloatType>(dg_v[i]);
+			}
+
+			// log Beta(u, v) = log Gamma(u) + log Gamma(v) - log Gamma(u + v)
+			LogGammaArray(p_u.data(), dg_u.data(), NUM_ELEMS);
+			LogGammaArray(p_v.data(), dg_v.data(), NUM_ELEMS);
+			LogGammaArray(p_uv.data(), dg_uv.data(), NUM_ELEMS);
+			for (int i = 0; i < NUM_ELEMS; ++i) {
+				log_beta_p[FIRST_IDX + i] = dg_u[i] + dg_v[i] - dg_uv[i];
+				p_u[i] /= p_uv[i];
+				p_v[i] /= p_uv[i];
+			}
+			LogArray(p_u.data(), &log_mean_p[FIRST_IDX], NUM_ELEMS);
+			LogArray(p_v.data(), &log_mean_1_p[FIRST_IDX], NUM_ELEMS);
+		}
+	});
+}
+
+void Expectations::UpdateQ(const Q& q, int first_indiv, int last_indiv)
+{
+	const int NUM_ELEMS = (last_indiv - first_indiv) * GetNumClusters();
+	std::vector<double> q_k(NUM_ELEMS), dg_q_k(NUM_ELEMS), q_0(last_indiv - first_indiv), dg_q_0(q_0.size());
+	for (int n = first_indiv, i = 0; n < last_indiv; ++n) {
+		q_0[n - first_indiv] = q.GetQ0(n);
+		for (int k = 0; k < GetNumClusters(); ++k, ++i)
+			q_k[i] = q.GetAdmixProp(n, k);
+	}
+
+	DigammaArray(q_k.data(), dg_q_k.data(), NUM_ELEMS);
+	DigammaArray(q_0.data(), dg_q_0.data(), static_cast<int>(q_0.size()));
+	const int FIRST_IDX = GetQIdx(first_indiv, 0);
+	for (int i = 0; i < NUM_ELEMS; ++i)
+		log_q[FIRST_IDX + i] = dg_q_k[i] - dg_q_0[i / GetNumClusters()];
+
+	ExpArray(&log_q[FIRST_IDX], dg_q_k.data(), NUM_ELEMS);
+	for (int i = 0; i < NUM_ELEMS; ++i)
+		exp_log_q[FIRST_IDX + i] = static_cast<FloatType>(dg_q_k[i]);
+}
+
+
+
+void Z::Update(const BitGenosMatrix& genos, const Expectations& exps, ThreadPool& pool)
+{
+	// Individuals are independent, so each thread updates its own range.
+	pool.ParallelFor(0, GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+		Update(genos, exps, first_indiv, last_indiv);
+	});
+}
+
+void Z::Update(const BitGenosMatrix& genos, const Expectations& exps, int first_indiv, int last_indiv)
+{
+	const StreamedZ STREAMED_Z(genos, exps);
+	for (int n = first_indiv; n < last_indiv; ++n)
+		for (int l = 0; l < GetNumLoci(); ++l)
+			STREAMED_Z.GetRows(n, l, assignments.GetRow(n, l, 0), assignments.GetRow(n, l, 1));
+}
+
+
+
+double CalculateLLBO(const Q& q, const Expectations& exps)
+{
+	const double LOG_DIR_ALPHA = LogGamma(q.alpha * q.GetNumClusters()) - q.GetNumClusters() * LogGamma(q.alpha);
+	double LLBO = 0.0;
+	for (int n = 0; n < q.GetNumIndivs(); ++n) {
+		LLBO += LOG_DIR_ALPHA - LogGamma(q.GetQ0(n));
+		for (int k = 0; k < q.GetNumClusters(); ++k) {
+			const double q_nk = q.GetAdmixProp(n, k);
+			LLBO += LogGamma(q_nk) + (q.alpha - q_nk) * exps.GetLogQ(n, k);
+		}
+	}
+	return LLBO;
+}
@@ -0,0 +1,671 @@
+#ifndef VB_KERNELS_H_
+#define VB_KERNELS_H_
+
+/// Variational parameters and kernels of the VB updates, shared by vb and vb_bench.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "aligned-tensor.h"
+#include "bit_genos_matrix.h"
+#include "simd-math.h"
+#include "thread-pool.h"
+
+// Uncomment to store variational parameters in double precision.
+//#define USE_DOUBLE_PRECISION				1
+
+// Uncomment at most one to change how the P and Q updates sum their terms, in double precision otherwise.
+//#define USE_FLOAT_ACCUMULATION			1
+//#define USE_KAHAN_SUMMATION				1
+
+
+
+#ifdef USE_DOUBLE_PRECISION
+typedef double FloatType;
+#else
+typedef float FloatType;
+#endif
+typedef AlignedTensor<FloatType> ParamsTensor;
+
+/// Running sum of the P and Q updates, which add up to N (or L) terms of Z in one parameter.
+/// T is the accumulation precision, independent of the storage precision FloatType.
+template <typename T>
+struct PlainSum
+{
+	PlainSum() : sum(0) {}
+
+	inline void Add(T x) { sum += x; }
+	inline T Get() const { return sum; }
+
+	T sum;
+};
+
+/// Kahan compensated sum: the rounding error of each addition is carried into the next one, so the
+/// error of N terms stays O(eps) instead of O(N eps), at 4 flops per term. Breaks under -ffast-math.
+template <typename T>
+struct KahanSum
+{
+	KahanSum() : sum(0), c(0) {}
+
+	inline void Add(T x)
+	{
+		const T y = x - c;
+		const T t = sum + y;
+		c = (t - sum) - y;
+		sum = t;
+	}
+	inline T Get() const { return sum; }
+
+	T sum;
+	T c;
+};
+
+#if defined(USE_KAHAN_SUMMATION)
+typedef KahanSum<FloatType> AccumType;
+#elif defined(USE_FLOAT_ACCUMULATION)
+typedef PlainSum<FloatType> AccumType;
+#else
+typedef PlainSum<double> AccumType;
+#endif
+
+
+
+static constexpr int NUM_CHROMOSOMES = 2;
+
+// Number of loci in each partial sum of the LLBO; fixed so the sum does not depend on the thread count.
+static constexpr int LLBO_BLOCK_LOCI = 64;
+
+
+
+inline double LogBeta(double x, double y)
+{
+	// beta function : (tgamma(x) * tgamma(y)) / tgamma(x + y)
+	const double res = LogGamma(x) + LogGamma(y) - LogGamma(x + y);
+	return res;  
+}
+
+/// Precision in which the P and Q updates sum their terms.
+const char* GetAccumulationName();
+
+inline void NormalizeRow(FloatType* row, int num_clusters)
+{
+	FloatType sm = static_cast<FloatType>(0.0);
+	for (int k = 0; k < num_clusters; ++k)
+		sm += row[k];
+	for (int k = 0; k < num_clusters; ++k)
+		row[k] /= sm;
+}
+
+
+
+struct Z
+{
+	Z() : num_indivs(0), num_loci(0), num_clusters(0) {}
+
+	inline void Init(int num_indivs, int num_loci, int num_clusters, uint64_t seed)
+	{
+		this->num_indivs = num_indivs;
+		this->num_loci = num_loci;
+		this->num_clusters = num_clusters;
+
+		// Indiv_n   <   l_0:[a: Z_1 .. Z_K | b: Z_1 .. Z_K]      ...      l_L:[a: Z_1 .. Z_K | b: Z_1 .. Z_K]   >
+		// Z is by far the largest tensor, so its cluster rows are not padded.
+		assignments.Init({ GetNumIndivs(), GetNumLoci(), NUM_CHROMOSOMES, GetNumClusters() });
+
+		// Initialize uniform.
+		std::mt19937_64 rd(seed);
+		std::uniform_real_distribution<FloatType> uf(0, 1);
+		for (int n = 0; n < GetNumIndivs(); ++n)
+			for (int l = 0; l < GetNumLoci(); ++l)
+				for (int k = 0; k < GetNumClusters(); ++k) {
+					SetAssignment(n, 0, l, k, static_cast<FloatType>(1.0 + 0.1 * (0.5 - uf(rd))));
+					SetAssignment(n, 1, l, k, static_cast<FloatType>(1.0 + 0.1 * (0.5 - uf(rd))));
+				}
+		Normalize();
+	}
+
+	inline FloatType GetAssignment(int indiv, int chromosome, int locus, int cluster) const
+	{
+		return assignments(indiv, locus, chromosome, cluster);
+	}
+
+	inline void SetAssignment(int indiv, int chromosome, int locus, int cluster, FloatType val)
+	{
+		assignments(indiv, locus, chromosome, cluster) = val;
+	}
+
+	/// Copies Z_{nl}^a and Z_{nl}^b rows; same interface as the Z-free sources.
+	inline void GetRows(int indiv, int locus, FloatType* z_a, FloatType* z_b) const
+	{
+		const FloatType* ROW_A = assignments.GetRow(indiv, locus, 0);
+		const FloatType* ROW_B = assignments.GetRow(indiv, locus, 1);
+		std::copy(ROW_A, ROW_A + GetNumClusters(), z_a);
+		std::copy(ROW_B, ROW_B + GetNumClusters(), z_b);
+	}
+
+	inline int GetNumIndivs() const { return num_indivs; }
+	inline int GetNumLoci() const { return num_loci; }
+	inline int GetNumClusters() const { return num_clusters; }
+
+	void Update(const BitGenosMatrix& genos, const struct Expectations& exps, ThreadPool& pool);
+	void Update(const BitGenosMatrix& genos, const struct Expectations& exps, int first_indiv, int last_indiv);
+
+	inline void Normalize() { Normalize(0, GetNumIndivs()); }
+
+	inline void Normalize(int first_indiv, int last_indiv)
+	{
+		for (int n = first_indiv; n < last_indiv; ++n) {
+			for (int l = 0; l < GetNumLoci(); ++l) {
+				NormalizeRow(assignments.GetRow(n, l, 0), GetNumClusters());
+				NormalizeRow(assignments.GetRow(n, l, 1), GetNumClusters());
+			}
+		}
+	}
+
+	int num_indivs;
+	int num_loci;
+	int num_clusters;
+	ParamsTensor assignments;
+};
+
+struct P
+{
+	static constexpr int NUM_PARAMS = 2;
+
+	P() : num_loci(0), num_clusters(0), beta(0), gamma(0) {}
+
+	void Init(int num_loci, int num_clusters)
+	{
+		this->num_loci = num_loci;
+		this->num_clusters = num_clusters;
+		beta = gamma = static_cast<FloatType>(0.5);
+
+		// P   <   l_0:[u: P_1 .. P_K | v: P_1 .. P_K]      ...      l_L[u: P_1 .. P_K | v: P_1 .. P_K]   >
+		freqs.Init({ GetNumLoci(), NUM_PARAMS, GetNumClusters() }, true);
+
+		// Initialize uniform.
+		for (int l = 0; l < GetNumLoci(); ++l)
+			for (int k = 0; k < GetNumClusters(); ++k) {
+				SetFreq(l, k, 0, static_cast<FloatType>(1.0));
+				SetFreq(l, k, 1, static_cast<FloatType>(1.0));
+			}
+	}
+
+	inline FloatType GetFreq(int num_loci, int num_cluster, int param_idx) const
+	{
+		return freqs(num_loci, param_idx, num_cluster);
+	}
+
+	inline void SetFreq(int num_loci, int num_cluster, int param_idx, FloatType val)
+	{
+		freqs(num_loci, param_idx, num_cluster) = val;
+	}
+
+	inline int GetNumLoci() const { return num_loci; }
+	inline int GetNumClusters() const { return num_clusters; }
+
+	/// ZRows is Z or one of the Z-free sources (StreamedZ, RandomZ); Accum is PlainSum or KahanSum.
+	template <typename Accum = AccumType, typename ZRows>
+	inline void Update(const BitGenosMatrix& genos, const ZRows& z, ThreadPool& pool)
+	{
+		// Each thread owns a range of loci, so every sum is accumulated by one thread in serial order.
+		pool.ParallelFor(0, GetNumLoci(), [&](int first_locus, int last_locus) {
+			Update<Accum>(genos, z, first_locus, last_locus);
+		});
+	}
+
+	template <typename Accum = AccumType, typename ZRows>
+	inline void Update(const BitGenosMatrix& genos, const ZRows& z, int first_locus, int last_locus)
+	{
+		// Individuals are visited genotype class by genotype class, so every sum is branch-free:
+		//   G == 0 : both chromosomes add to v,   G == 1 : a adds to u, b adds to v,   G == 2 : both add to u.
+		// A monomorphic locus has only one non-empty class and the other parameter stays at its prior.
+		// Missing calls are in no class, so they add nothing to either sum.
+		BitGenosMatrix::LocusClasses classes;
+		std::vector<FloatType> z_a(GetNumClusters()), z_b(GetNumClusters());
+		std::vector<Accum> sm_za(GetNumClusters()), sm_zb(GetNumClusters());
+		for (int l = first_locus; l < last_locus; ++l) {
+			genos.GetLocusClasses(l, classes);
+			std::fill(sm_za.begin(), sm_za.end(), Accum());
+			std::fill(sm_zb.begin(), sm_zb.end(), Accum());
+			for (const int* n = classes.Begin(0); n != classes.End(0); ++n) {
+				z.GetRows(*n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k)
+					sm_zb[k].Add(z_a[k] + z_b[k]);
+			}
+			for (const int* n = classes.Begin(1); n != classes.End(1); ++n) {
+				z.GetRows(*n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k) {
+					sm_za[k].Add(z_a[k]);
+					sm_zb[k].Add(z_b[k]);
+				}
+			}
+			for (const int* n = classes.Begin(2); n != classes.End(2); ++n) {
+				z.GetRows(*n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k)
+					sm_za[k].Add(z_a[k] + z_b[k]);
+			}
+			for (int k = 0; k < GetNumClusters(); ++k) {
+				SetFreq(l, k, 0, static_cast<FloatType>(beta + sm_za[k].Get()));
+				SetFreq(l, k, 1, static_cast<FloatType>(gamma + sm_zb[k].Get()));
+			}
+		}
+	}
+
+	/// Same update for genotype sources without class lists (MappedGenosMatrix), one genotype at a time.
+	template <typename Accum = AccumType, typename Genos, typename ZRows>
+	inline void UpdateFromGenos(const Genos& genos, const ZRows& z, int first_locus, int last_locus)
+	{
+		std::vector<FloatType> z_a(GetNumClusters()), z_b(GetNumClusters());
+		std::vector<Accum> sm_za(GetNumClusters()), sm_zb(GetNumClusters());
+		for (int l = first_locus; l < last_locus; ++l) {
+			std::fill(sm_za.begin(), sm_za.end(), Accum());
+			std::fill(sm_zb.begin(), sm_zb.end(), Accum());
+			for (int n = 0; n < genos.GetNumIndivs(); ++n) {
+				const int G = genos.GetGeno(n, l);
+				if (G == BitGenosMatrix::MISSING_GENO)
+					continue;
+				z.GetRows(n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k) {
+					const FloatType z_ab = z_a[k] + z_b[k];
+					sm_za[k].Add((G == 1 ? z_a[k] : 0) + (G == 2 ? z_ab : 0));
+					sm_zb[k].Add((G == 1 ? z_b[k] : 0) + (G == 0 ? z_ab : 0));
+				}
+			}
+			for (int k = 0; k < GetNumClusters(); ++k) {
+				SetFreq(l, k, 0, static_cast<FloatType>(beta + sm_za[k].Get()));
+				SetFreq(l, k, 1, static_cast<FloatType>(gamma + sm_zb[k].Get()));
+			}
+		}
+	}
+
+	/// Natural gradient step of stochastic VI from the minibatch `indivs':
+	///   u <- (1 - rho) u + rho (beta + scale sum_{n in batch} ...),   scale = N / |batch|,   and v alike.
+	template <typename Accum = AccumType, typename ZRows>
+	inline void UpdateStochastic(const BitGenosMatrix& genos, const ZRows& z, const std::vector<int>& indivs,
+			double rho, ThreadPool& pool)
+	{
+		const double SCALE = static_cast<double>(genos.GetNumIndivs()) / indivs.size();
+		pool.ParallelFor(0, GetNumLoci(), [&](int first_locus, int last_locus) {
+			std::vector<FloatType> z_a(GetNumClusters()), z_b(GetNumClusters());
+			std::vector<Accum> sm_za(GetNumClusters()), sm_zb(GetNumClusters());
+			for (int l = first_locus; l < last_locus; ++l) {
+				std::fill(sm_za.begin(), sm_za.end(), Accum());
+				std::fill(sm_zb.begin(), sm_zb.end(), Accum());
+				for (const int n : indivs) {
+					const int G = genos.GetGeno(n, l);
+					if (G == BitGenosMatrix::MISSING_GENO)
+						continue;
+					z.GetRows(n, l, z_a.data(), z_b.data());
+					for (int k = 0; k < GetNumClusters(); ++k) {
+						const FloatType z_ab = z_a[k] + z_b[k];
+						sm_za[k].Add((G == 1 ? z_a[k] : 0) + (G == 2 ? z_ab : 0));
+						sm_zb[k].Add((G == 1 ? z_b[k] : 0) + (G == 0 ? z_ab : 0));
+					}
+				}
+				for (int k = 0; k < GetNumClusters(); ++k) {
+					SetFreq(l, k, 0, static_cast<FloatType>((1.0 - rho) * GetFreq(l, k, 0) + rho * (beta + SCALE * sm_za[k].Get())));
+					SetFreq(l, k, 1, static_cast<FloatType>((1.0 - rho) * GetFreq(l, k, 1) + rho * (gamma + SCALE * sm_zb[k].Get())));
+				}
+			}
+		});
+	}
+
+	inline void Update2(const BitGenosMatrix& genos, const Z& z)
+	{
+		BitGenosMatrix::LocusClasses classes;
+		for (int l = 0; l < GetNumLoci(); ++l) {
+			genos.GetLocusClasses(l, classes);
+			for (int k = 0; k < GetNumClusters(); ++k) {
+				FloatType sm_za = static_cast<FloatType>(0.0);
+				FloatType sm_zb = static_cast<FloatType>(0.0);
+				for (const int* n = classes.Begin(0); n != classes.End(0); ++n)
+					sm_zb += z.GetAssignment(*n, 0, l, k) + z.GetAssignment(*n, 1, l, k);
+				for (const int* n = classes.Begin(1); n != classes.End(1); ++n) {
+					sm_za += z.GetAssignment(*n, 0, l, k);
+					sm_zb += z.GetAssignment(*n, 1, l, k);
+				}
+				for (const int* n = classes.Begin(2); n != classes.End(2); ++n)
+					sm_za += z.GetAssignment(*n, 0, l, k) + z.GetAssignment(*n, 1, l, k);
+				SetFreq(l, k, 0, beta + sm_za);
+				SetFreq(l, k, 1, gamma + sm_zb);
+			}
+		}
+	}
+
+	int num_loci;
+	int num_clusters;
+	FloatType beta;
+	FloatType gamma;
+	ParamsTensor freqs;
+};
+
+struct Q
+{
+	Q() : num_indivs(0), num_clusters(0), alpha(0) {}
+
+	inline void Init(int num_indivs, int num_clusters)
+	{
+		this->num_indivs = num_indivs;
+		this->num_clusters = num_clusters;
+		alpha = static_cast<FloatType>(1.0 / GetNumClusters());
+
+		props.Init({ GetNumIndivs(), GetNumClusters() }, true);
+
+		// Initialize uniform.
+		for (int n = 0; n < GetNumIndivs(); ++n)
+			for (int k = 0; k < GetNumClusters(); ++k)
+				SetAdmixProp(n, k, static_cast<FloatType>(1.0 / GetNumClusters()));
+	}
+
+	inline FloatType GetAdmixProp(int indiv, int cluster) const { return props(indiv, cluster); }
+	inline void SetAdmixProp(int indiv, int cluster, FloatType val) { props(indiv, cluster) = val; }
+
+	inline int GetNumIndivs() const { return num_indivs; }
+	inline int GetNumClusters() const { return num_clusters; }
+
+	/// ZRows is Z or one of the Z-free sources (StreamedZ, RandomZ); Accum is PlainSum or KahanSum.
+	template <typename Accum = AccumType, typename ZRows>
+	inline void Update(const ZRows& z, ThreadPool& pool)
+	{
+		pool.ParallelFor(0, GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+			Update<Accum>(z, first_indiv, last_indiv);
+		});
+	}
+
+	template <typename Accum = AccumType, typename ZRows>
+	inline void Update(const ZRows& z, int first_indiv, int last_indiv)
+	{
+		// The rows of a missing call are zero, so q_n counts only the observed loci of n.
+		std::vector<FloatType> z_a(GetNumClusters()), z_b(GetNumClusters());
+		std::vector<Accum> sm_z_ab(GetNumClusters());
+		for (int n = first_indiv; n < last_indiv; ++n) {
+			std::fill(sm_z_ab.begin(), sm_z_ab.end(), Accum());
+			for (int l = 0; l < z.GetNumLoci(); ++l) {
+				z.GetRows(n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k)
+					sm_z_ab[k].Add(z_a[k] + z_b[k]);
+			}
+			for (int k = 0; k < GetNumClusters(); ++k)
+				SetAdmixProp(n, k, static_cast<FloatType>(alpha + sm_z_ab[k].Get()));
+		}
+	}
+
+	/// Adds sum_{l in [first_locus, last_locus)} z^a_{nlk} + z^b_{nlk} to sm_z_ab[n K + k] for n in [first_indiv, last_indiv).
+	/// Summing the blocks of loci in order and calling SetFromSums gives the same Q as Update.
+	template <typename ZRows, typename Accum>
+	inline void AddSums(const ZRows& z, int first_locus, int last_locus, int first_indiv, int last_indiv,
+			Accum* sm_z_ab) const
+	{
+		std::vector<FloatType> z_a(GetNumClusters()), z_b(GetNumClusters());
+		for (int n = first_indiv; n < last_indiv; ++n) {
+			Accum* sm = sm_z_ab + static_cast<size_t>(n) * GetNumClusters();
+			for (int l = first_locus; l < last_locus; ++l) {
+				z.GetRows(n, l, z_a.data(), z_b.data());
+				for (int k = 0; k < GetNumClusters(); ++k)
+					sm[k].Add(z_a[k] + z_b[k]);
+			}
+		}
+	}
+
+	template <typename Accum>
+	inline void SetFromSums(const Accum* sm_z_ab)
+	{
+		for (int n = 0; n < GetNumIndivs(); ++n)
+			for (int k = 0; k < GetNumClusters(); ++k)
+				SetAdmixProp(n, k, static_cast<FloatType>(alpha + sm_z_ab[static_cast<size_t>(n) * GetNumClusters() + k].Get()));
+	}
+
+	inline FloatType GetQ0(int n) const
+	{
+		FloatType sm = static_cast<FloatType>(0.0);
+		for (int k = 0; k < GetNumClusters(); ++k)
+			sm += GetAdmixProp(n, k);
+		return sm;
+	}
+
+	inline int GetIndivCluster(int n) const
+	{
+		const FloatType Q_0 = GetQ0(n);
+		FloatType max_prop = static_cast<FloatType>(-1.0);
+		int max_k = -1;
+		for (int k = 0; k < GetNumClusters(); ++k) {
+			const FloatType PROP = GetAdmixProp(n, k) / Q_0;
+			if (max_prop < PROP) {
+				max_prop = PROP;
+				max_k = k;
+			}
+		}
+		return max_k;
+	}
+
+	int num_indivs;
+	int num_clusters;
+	FloatType alpha;
+	ParamsTensor props;
+};
+
+
+
+/// Per iteration cache of the expectations that Z, LLBO and log probabilities need.
+/// The P part depends only on (l, k) and the Q part only on (n, k), so they are
+/// rebuilt once after P or Q is updated instead of inside the N x L x K loops.
+struct Expectations
+{
+	Expectations() : num_indivs(0), num_loci(0), num_clusters(0) {}
+
+	inline void Init(int num_indivs, int num_loci, int num_clusters)
+	{
+		this->num_indivs = num_indivs;
+		this->num_loci = num_loci;
+		this->num_clusters = num_clusters;
+
+		const int NUM_P_ELEMS = GetNumLoci() * GetNumClusters();
+		const int NUM_Q_ELEMS = GetNumIndivs() * GetNumClusters();
+		log_p.assign(NUM_P_ELEMS, 0.0);
+		log_1_p.assign(NUM_P_ELEMS, 0.0);
+		log_mean_p.assign(NUM_P_ELEMS, 0.0);
+		log_mean_1_p.assign(NUM_P_ELEMS, 0.0);
+		exp_log_p.assign(NUM_P_ELEMS, static_cast<FloatType>(1.0));
+		exp_log_1_p.assign(NUM_P_ELEMS, static_cast<FloatType>(1.0));
+		log_beta_p.assign(NUM_P_ELEMS, 0.0);
+		log_q.assign(NUM_Q_ELEMS, 0.0);
+		exp_log_q.assign(NUM_Q_ELEMS, static_cast<FloatType>(1.0));
+	}
+
+	inline int GetNumIndivs() const { return num_indivs; }
+	inline int GetNumLoci() const { return num_loci; }
+	inline int GetNumClusters() const { return num_clusters; }
+	inline int GetPIdx(int locus, int cluster) const { return GetNumClusters() * locus + cluster; }
+	inline int GetQIdx(int indiv, int cluster) const { return GetNumClusters() * indiv + cluster; }
+
+	// E [[ log(P_{lk}) ]]     E [[ log(1 - P_{lk}) ]]
+	inline double GetLogP(int locus, int cluster) const { return log_p[GetPIdx(locus, cluster)]; }
+	inline double GetLog1P(int locus, int cluster) const { return log_1_p[GetPIdx(locus, cluster)]; }
+
+	// log(E [[ P_{lk} ]])     log(E [[ 1 - P_{lk} ]])
+	inline double GetLogMeanP(int locus, int cluster) const { return log_mean_p[GetPIdx(locus, cluster)]; }
+	inline double GetLogMean1P(int locus, int cluster) const { return log_mean_1_p[GetPIdx(locus, cluster)]; }
+
+	// exp(E [[ log(P_{lk}) ]])     exp(E [[ log(1 - P_{lk}) ]])
+	inline FloatType GetExpLogP(int locus, int cluster) const { return exp_log_p[GetPIdx(locus, cluster)]; }
+	inline FloatType GetExpLog1P(int locus, int cluster) const { return exp_log_1_p[GetPIdx(locus, cluster)]; }
+
+	// log Beta(u_{lk}, v_{lk})
+	inline double GetLogBetaP(int locus, int cluster) const { return log_beta_p[GetPIdx(locus, cluster)]; }
+
+	// E [[ log(Q_{nk}) ]]     exp(E [[ log(Q_{nk}) ]])
+	inline double GetLogQ(int indiv, int cluster) const { return log_q[GetQIdx(indiv, cluster)]; }
+	inline FloatType GetExpLogQ(int indiv, int cluster) const { return exp_log_q[GetQIdx(indiv, cluster)]; }
+
+	void UpdateP(const P& p, ThreadPool& pool);
+
+	inline void UpdateQ(const Q& q, ThreadPool& pool)
+	{
+		pool.ParallelFor(0, GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+			UpdateQ(q, first_indiv, last_indiv);
+		});
+	}
+
+	void UpdateQ(const Q& q, int first_indiv, int last_indiv);
+
+	int num_indivs;
+	int num_loci;
+	int num_clusters;
+
+	std::vector<double> log_p;
+	std::vector<double> log_1_p;
+	std::vector<double> log_mean_p;
+	std::vector<double> log_mean_1_p;
+	std::vector<FloatType> exp_log_p;
+	std::vector<FloatType> exp_log_1_p;
+	std::vector<double> log_beta_p;
+	std::vector<double> log_q;
+	std::vector<FloatType> exp_log_q;
+};
+
+
+
+/// Z-free view of the assignments. Every (n, l) row is recomputed from the cached
+/// expectations when it is needed, so the N x L x K x 2 tensor is never stored.
+/// Genos is BitGenosMatrix or MappedGenosMatrix.
+template <typename Genos>
+struct StreamedZ
+{
+	StreamedZ(const Genos& genos, const Expectations& exps) : genos(genos), exps(exps) {}
+
+	inline int GetNumIndivs() const { return exps.GetNumIndivs(); }
+	inline int GetNumLoci() const { return exps.GetNumLoci(); }
+	inline int GetNumClusters() const { return exps.GetNumClusters(); }
+
+	inline void GetRows(int indiv, int locus, FloatType* z_a, FloatType* z_b) const
+	{
+		// Z_{nlk} ~ exp(E[log P] + E[log Q]) is a product of cached factors, the normalization removes the scale.
+		// A missing call has no assignment; its zero rows drop it from every sum over Z.
+		const int G = genos.GetGeno(indiv, locus);
+		if (G == BitGenosMatrix::MISSING_GENO) {
+			std::fill(z_a, z_a + GetNumClusters(), static_cast<FloatType>(0.0));
+			std::fill(z_b, z_b + GetNumClusters(), static_cast<FloatType>(0.0));
+			return;
+		}
+		for (int k = 0; k < GetNumClusters(); ++k) {
+			const FloatType exp_q = exps.GetExpLogQ(indiv, k);
+			const FloatType exp_a = G == 0 ? exps.GetExpLog1P(locus, k) : exps.GetExpLogP(locus, k);
+			const FloatType exp_b = G == 2 ? exps.GetExpLogP(locus, k) : exps.GetExpLog1P(locus, k);
+			z_a[k] = exp_a * exp_q;
+			z_b[k] = exp_b * exp_q;
+		}
+		NormalizeRow(z_a, GetNumClusters());
+		NormalizeRow(z_b, GetNumClusters());
+	}
+
+	const Genos& genos;
+	const Expectations& exps;
+};
+
+/// Z-free random initial assignments, the same distribution as Z::Init.
+/// Rows come from a counter based generator, so they are reproducible and do not
+/// depend on the order or the thread in which they are requested.
+struct RandomZ
+{
+	RandomZ(int num_indivs, int num_loci, int num_clusters, uint64_t seed)
+		: num_indivs(num_indivs), num_loci(num_loci), num_clusters(num_clusters), seed(seed)
+	{}
+
+	inline int GetNumIndivs() const { return num_indivs; }
+	inline int GetNumLoci() const { return num_loci; }
+	inline int GetNumClusters() const { return num_clusters; }
+
+	inline void GetRows(int indiv, int locus, FloatType* z_a, FloatType* z_b) const
+	{
+		uint64_t state = seed + (static_cast<uint64_t>(indiv) * GetNumLoci() + locus) * 0x9E3779B97F4A7C15ULL;
+		for (int k = 0; k < GetNumClusters(); ++k) {
+			z_a[k] = static_cast<FloatType>(1.0 + 0.1 * (0.5 - NextUniform(state)));
+			z_b[k] = static_cast<FloatType>(1.0 + 0.1 * (0.5 - NextUniform(state)));
+		}
+		NormalizeRow(z_a, GetNumClusters());
+		NormalizeRow(z_b, GetNumClusters());
+	}
+
+	static inline uint64_t NextRandom(uint64_t& state)
+	{
+		// SplitMix64
+		uint64_t x = (state += 0x9E3779B97F4A7C15ULL);
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	static inline double NextUniform(uint64_t& state)
+	{
+		return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	int num_indivs;
+	int num_loci;
+	int num_clusters;
+	uint64_t seed;
+};
+
+
+
+/// Locus part of the LLBO:
+///   sum_{n,l,k,c} z^c_{nlk} (E[log P(G_{nl} | Z, P)] + E[log Q_{nk}] - log z^c_{nlk})  +  sum_{l,k} -KL(P_{lk})
+/// Every term is O(1) per (n, l, k) given the cached expectations. Missing calls are not observed and add nothing.
+template <typename Genos, typename ZRows>
+double CalculateLLBO(const Genos& genos, const ZRows& z, const P& p, const Expectations& exps,
+		int first_locus, int last_locus)
+{
+	const double LOG_BETA_B_G = LogBeta(p.beta, p.gamma);
+
+	std::vector<FloatType> z_a(z.GetNumClusters()), z_b(z.GetNumClusters());
+	double LLBO = 0.0;
+	for (int l = first_locus; l < last_locus; ++l) {
+		for (int n = 0; n < genos.GetNumIndivs(); ++n) {
+			const int G = genos.GetGeno(n, l);
+			if (G == BitGenosMatrix::MISSING_GENO)
+				continue;
+			z.GetRows(n, l, z_a.data(), z_b.data());
+			for (int k = 0; k < z.GetNumClusters(); ++k) {
+				// Chromosome a carries allele 1 unless G == 0, chromosome b only if G == 2.
+				const double log_pa = G == 0 ? exps.GetLog1P(l, k) : exps.GetLogP(l, k);
+				const double log_pb = G == 2 ? exps.GetLogP(l, k) : exps.GetLog1P(l, k);
+				const double log_q = exps.GetLogQ(n, k);
+				const double za = z_a[k];
+				const double zb = z_b[k];
+				if (za > 0)
+					LLBO += za * (log_pa + log_q - log(za));
+				if (zb > 0)
+					LLBO += zb * (log_pb + log_q - log(zb));
+			}
+		}
+
+		// E [[ log Beta(P_{lk}; beta, gamma) ]] - E [[ log Beta(P_{lk}; u, v) ]]
+		for (int k = 0; k < p.GetNumClusters(); ++k) {
+			const double p_u = p.GetFreq(l, k, 0);
+			const double p_v = p.GetFreq(l, k, 1);
+			LLBO += exps.GetLogBetaP(l, k) - LOG_BETA_B_G
+				+ (p.beta - p_u) * exps.GetLogP(l, k) + (p.gamma - p_v) * exps.GetLog1P(l, k);
+		}
+	}
+	return LLBO;
+}
+
+/// Individual part of the LLBO:   sum_n E [[ log Dir(Q_n; alpha) ]] - E [[ log Dir(Q_n; q_n) ]]
+double CalculateLLBO(const Q& q, const Expectations& exps);
+
+/// Evidence lower bound of the current variational parameters in O(N L K).
+template <typename ZRows>
+double CalculateLLBO(const BitGenosMatrix& genos, const ZRows& z, const Q& q, const P& p,
+		const Expectations& exps, ThreadPool& pool)
+{
+	const double LLBO = pool.ParallelSum(0, genos.GetNumLoci(), LLBO_BLOCK_LOCI, [&](int first_locus, int last_locus) {
+		return CalculateLLBO(genos, z, p, exps, first_locus, last_locus);
+	});
+	return LLBO + CalculateLLBO(q, exps);
+}
+
+#endif
@@ -1,30 +1,49 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include <utility>
 
+#include "aligned-tensor.h"
 #include "bit_genos_matrix.h"
+#include "cluster-matching.h"
+#include "file-writer.h"
 #include "logger.h"
-
-// Comment to use raw pointers.
-#define USE_VECTOR							1
+#include "mapped-genos.h"
+#include "simd-math.h"
+#include "text-genos.h"
+#include "thread-pool.h"
+#include "vb_kernels.h"
+
+#if defined __linux__
+#include <unistd.h>
+#endif
 
 // Uncomment only one of the following lines.
+// READ_GENOTYPES_FROM_BINARY_FILE copies packed genotype files into memory instead of mapping them.
 //#define READ_GENOTYPES_FROM_BINARY_FILE	1
 //#define MAKE_RANDOM_FREQS					1
 
-// Uncomment to calculate LLBO for checking convergence.
-//#define USE_LLBO							1
+// Uncomment to compile the phase timers of --timings out of the iterations.
+//#define DISABLE_PHASE_TIMERS				1
 
 
 
-typedef float FloatType;
 typedef std::vector<std::vector<std::pair<double, double>>> FreqsVector;
 
 
@@ -37,10 +56,33 @@ static constexpr int MAX_ITERS   = 10;
 static constexpr int ITER_REPORT = 10;
 static constexpr int MIN_ITERS = 5;
 
-//static constexpr int LLBO_UPDATE = 10;
-static constexpr double LLBO_EPSILON = 1;
+// Defaults of --llbo-every and --epsilon: the LLBO is evaluated every LLBO_UPDATE iterations
+// and the run stops once it gains less than LLBO_EPSILON per genotype.
+static constexpr int LLBO_UPDATE = 5;
+static constexpr double LLBO_EPSILON = 1e-6;
+
+// Number of times an invalid SQUAREM jump is pulled back towards the plain step before it is given up.
+static constexpr int SQUAREM_BACKTRACKS = 10;
+
+// Defaults of --svi-tau and --svi-kappa, the SVI learning rate of step t is (SVI_TAU + t)^-SVI_KAPPA.
+static constexpr double SVI_TAU = 1.0;
+static constexpr double SVI_KAPPA = 0.6;
+
+// Local Q and Z updates of each minibatch individual before the SVI step on P.
+static constexpr int SVI_LOCAL_ITERS = 5;
+
+// Number of (l, G, k) entries of the genotype log probability table that one parallel pass over the
+// individuals adds up, so the table of a block of loci stays in the L1 cache.
+static constexpr int LOG_PROBS_BLOCK_ELEMS = 2048;
+
+// Loci of a memory-mapped genotype file that are processed, and resident, at once.
+static constexpr int OOC_BLOCK_LOCI = 1024;
+
+// Seconds between two checkpoints of a fit.
+static constexpr double CHECKPOINT_SECONDS = 600;
 
-static constexpr int NUM_CHROMOSOMES = 2;
+// Largest default share of the genotype entries that a cross-validation fold holds out, at most 1 / F of F folds.
+static constexpr double CV_FRACTION = 0.1;
 
 
 
@@ -53,588 +95,258 @@ static const std::string DUMP_PATH =
 
 static const std::string FREQS_PATH = DUMP_PATH + "freqs.txt";
 static const std::string GENOS_PATH = DUMP_PATH + "genos.txt";
+static const std::string TIMINGS_PATH = DUMP_PATH + "timings.jsonl";
 
 
 
-static double digammal(double x)
-{
-	double result = 0, xx, xx2, xx4;
-	if (x <= 0) {
-		logger << Time << " Input error!    digamma(x:" << x << " <= 0)" << std::endl;
-		exit(1);
-	}
-	for (; x < 7; ++x)
-		result -= 1 / x;
-	x -= 1.0 / 2.0;
-	xx = 1.0 / x;
-	xx2 = xx*xx;
-	xx4 = xx2*xx2;
-	result += log(x) + (1. / 24.)*xx2 - (7.0 / 960.0)*xx4 + (31.0 / 8064.0)*xx4*xx2 - (127.0 / 30720.0)*xx4*xx4;
-	return result;
-}
-
-inline static FloatType digamma(FloatType x)
-{
-	return static_cast<FloatType>(digammal(static_cast<double>(x)));
-}
-
-inline static double LogBeta(double x, double y)
-{
-	// beta function : (tgamma(x) * tgamma(y)) / tgamma(x + y)
-	const double res = lgamma(x) + lgamma(y) - lgamma(x + y);
-	return res;  
-}
-
-inline static double LogFact(int x)
-{
-	double res = 0.0;
-	for (int i = 2; i < x; ++i)
-		res += log(i);
-	return res;
-}
-
-inline static double Comb(int n, int k)
-{
-	if (k == 0 || k == n)
-		return 1.0;
-
-	if (k == 1 || k == n - 1)
-		return n;
 
-	const double log_comb = LogFact(n) - LogFact(n - k) - LogFact(k);
-	const double exp_comb = exp(log_comb);
-	return exp_comb;
-}
 
 
 
-struct Z
+/// Genotypes of one cross-validation fold: the held-out entries of `genos' read as MISSING_GENO, so every
+/// kernel skips them like a missing call and all folds share the one matrix instead of a masked copy each.
+/// Entry (n, l) draws u in [0, 1) from a counter based hash of `seed', the same for every fold; fold f holds
+/// out the entries with u in [f r, (f + 1) r) modulo 1 for the held-out fraction r, so folds are disjoint while F r <= 1.
+/// Genos is BitGenosMatrix or MappedGenosMatrix.
+template <typename Genos>
+struct HeldOutGenos
 {
-	Z() : num_indivs(0), num_loci(0), num_clusters(0)
-#ifndef USE_VECTOR
-		, assignments(nullptr)
-#endif
+	HeldOutGenos(const Genos& genos, uint64_t seed, int fold, double fraction)
+		: genos(genos), seed(seed), first(fold * fraction - std::floor(fold * fraction)), fraction(fraction)
 	{}
 
-	~Z()
-	{
-#ifndef USE_VECTOR
-		delete[] assignments; assignments = nullptr;
-#endif
-		num_indivs = num_loci = num_clusters = 0;
-	}
-
-	inline void Init(int num_indivs, int num_loci, int num_clusters)
-	{
-		this->num_indivs = num_indivs;
-		this->num_loci = num_loci;
-		this->num_clusters = num_clusters;
-
-#ifdef USE_VECTOR
-		assignments.resize(GetNumIndivs());
-		for (int n = 0; n < GetNumIndivs(); ++n) {
-			assignments[n].resize(NUM_CHROMOSOMES);
-			for (int c = 0; c < NUM_CHROMOSOMES; ++c) {
-				assignments[n][c].resize(GetNumLoci());
-				for (int l = 0; l < GetNumLoci(); ++l)
-					assignments[n][c][l].resize(GetNumClusters());
-			}
-		}
-#else
-		const int NUM_ELEMS = GetNumIndivs() * GetNumLoci() * GetNumClusters() * NUM_CHROMOSOMES;
-		assignments = new FloatType[NUM_ELEMS];
-#endif
-		// Initialize uniform.
-		std::random_device rd;
-		std::uniform_real_distribution<FloatType> uf(0, 1);
-		for (int n = 0; n < GetNumIndivs(); ++n)
-			for (int l = 0; l < GetNumLoci(); ++l)
-				for (int k = 0; k < GetNumClusters(); ++k) {
-					SetAssignment(n, 0, l, k, static_cast<FloatType>(1.0 + 0.1 * (0.5 - uf(rd))));
-					SetAssignment(n, 1, l, k, static_cast<FloatType>(1.0 + 0.1 * (0.5 - uf(rd))));
-				}
-		Normalize();
-	}
-
-	inline FloatType GetAssignment(int indiv, int chromosome, int locus, int cluster) const
-	{
-#ifdef USE_VECTOR
-		return assignments[indiv][chromosome][locus][cluster];
-#else
-		return assignments[GetIdx(indiv, chromosome, locus, cluster)];
-#endif
-	}
-
-	inline void SetAssignment(int indiv, int chromosome, int locus, int cluster, FloatType val)
-	{
-#ifdef USE_VECTOR
-		assignments[indiv][chromosome][locus][cluster] = val;
-#else
-		assignments[GetIdx(indiv, chromosome, locus, cluster)] = val;
-#endif
-	}
-
-	inline int GetNumIndivs() const { return num_indivs; }
-	inline int GetNumLoci() const { return num_loci; }
-	inline int GetNumClusters() const { return num_clusters; }
+	inline int GetNumIndivs() const { return genos.GetNumIndivs(); }
+	inline int GetNumLoci() const { return genos.GetNumLoci(); }
+	inline int GetNumClusters() const { return genos.GetNumClusters(); }
 
-	inline int GetIdx(int indiv, int chrom, int locus, int cluster) const
+	inline bool IsHeldOut(int indiv, int locus) const
 	{
-		// Indiv_n   <   l_0:[a: Z_1 .. Z_K | b: Z_1 .. Z_K]      ...      l_L:[a: Z_1 .. Z_K | b: Z_1 .. Z_K]   >
-		const int INDIV_START = indiv * GetNumLoci() * GetNumClusters() * NUM_CHROMOSOMES;
-		const int LOCUS_START = locus * GetNumClusters() * NUM_CHROMOSOMES;
-		const int CLUSTER_START = chrom * GetNumClusters();
-		return INDIV_START + LOCUS_START + CLUSTER_START + cluster;
+		uint64_t state = seed + (static_cast<uint64_t>(indiv) * GetNumLoci() + locus) * 0x9E3779B97F4A7C15ULL;
+		double u = RandomZ::NextUniform(state) - first;
+		if (u < 0)
+			u += 1.0;
+		return u < fraction;
 	}
 
-	inline void Update(const BitGenosMatrix& genos, const struct P& p, const struct Q& q);
-
-	inline void Normalize()
-	{
-		for (int n = 0; n < GetNumIndivs(); ++n) {
-			for (int l = 0; l < GetNumLoci(); ++l) {
-				FloatType sm_c0 = static_cast<FloatType>(0.0);
-				FloatType sm_c1 = static_cast<FloatType>(0.0);
-				for (int k = 0; k < GetNumClusters(); ++k) {
-					sm_c0 += GetAssignment(n, 0, l, k);
-					sm_c1 += GetAssignment(n, 1, l, k);
-				}
-				for (int k = 0; k < GetNumClusters(); ++k) {
-					const FloatType norm_c0 = GetAssignment(n, 0, l, k) / sm_c0;
-					const FloatType norm_c1 = GetAssignment(n, 1, l, k) / sm_c1;
-					SetAssignment(n, 0, l, k, norm_c0);
-					SetAssignment(n, 1, l, k, norm_c1);
-				}
-			}
-		}
-	}
-
-	inline double GetEntropy(int indiv, int chromosome, int locus) const
+	inline int GetGeno(int indiv, int locus) const
 	{
-		double ent = -LogFact(GetNumIndivs());
-
-		double sm = 0.0;
-		for (int i = 0; i < GetNumClusters(); ++i) {
-			const FloatType z_i = GetAssignment(indiv, chromosome, locus, i);
-			sm += z_i * log(z_i);
-		}
-		ent -= GetNumIndivs() * sm;
-
-		sm = 0.0;
-		for (int i = 0; i < GetNumClusters(); ++i) {
-			for (int x_i = 0; x_i < GetNumClusters(); ++x_i) {
-				const FloatType p_i = GetAssignment(indiv, chromosome, locus, i);
-				sm += Comb(GetNumClusters(), x_i) * pow(p_i, x_i) * pow(1.0 - p_i, GetNumClusters() - x_i) * LogFact(x_i);
-			}
-		}
-		ent += sm;
-		return ent;
+		return IsHeldOut(indiv, locus) ? BitGenosMatrix::MISSING_GENO : genos.GetGeno(indiv, locus);
 	}
 
-	int num_indivs;
-	int num_loci;
-	int num_clusters;
-
-#ifdef USE_VECTOR
-	std::vector<std::vector<std::vector<std::vector<FloatType>>>> assignments;
-#else
-	FloatType* assignments;
-#endif
+	const Genos& genos;
+	uint64_t seed;
+	double first;
+	double fraction;
 };
 
-struct P
-{
-	static constexpr int NUM_PARAMS = 2;
-
-	P() : num_loci(0), num_clusters(0), beta(0), gamma(0)
-#ifndef USE_VECTOR
-		, freqs(nullptr)
-#endif
-	{}
-
-	~P()
-	{
-#ifndef USE_VECTOR
-		delete[] freqs; freqs = nullptr;
-#endif
-	}
-
-	void Init(int num_loci, int num_clusters)
-	{
-		this->num_loci = num_loci;
-		this->num_clusters = num_clusters;
-		beta = gamma = static_cast<FloatType>(0.5);
-
-#ifdef USE_VECTOR
-		freqs.resize(GetNumClusters());
-		for (int k = 0; k < GetNumClusters(); ++k)
-			freqs[k].resize(GetNumLoci());
-#else
-		const int NUM_ELEMS = NUM_PARAMS * GetNumClusters() * GetNumLoci();
-		freqs = new FloatType[NUM_ELEMS];
-#endif
-
-		// Initialize uniform.
-		for (int l = 0; l < GetNumLoci(); ++l)
-			for (int k = 0; k < GetNumClusters(); ++k) {
-				SetFreq(l, k, 0, static_cast<FloatType>(1.0));
-				SetFreq(l, k, 1, static_cast<FloatType>(1.0));
-			}
-	}
-
-	inline FloatType GetFreq(int num_loci, int num_cluster, int param_idx) const
-	{
-#ifdef USE_VECTOR
-		const auto& p = freqs[num_cluster][num_loci];
-		return param_idx == 0 ? p.first : p.second;
-#else
-		return freqs[GetIdx(num_loci, num_cluster, param_idx)];
-#endif
-	}
-
-	inline void SetFreq(int num_loci, int num_cluster, int param_idx, FloatType val)
-	{
-#ifdef USE_VECTOR
-		auto& p = freqs[num_cluster][num_loci];
-		if (param_idx == 0)
-			p.first = val;
-		else
-			p.second = val;
-#else
-		freqs[GetIdx(num_loci, num_cluster, param_idx)] = val;
-#endif
-	}
-
-	inline int GetNumLoci() const { return num_loci; }
-	inline int GetNumClusters() const { return num_clusters; }
-
-	inline int GetIdx(int num_loci, int num_cluster, int param_idx) const
-	{
-		// P   <   l_0:[u: P_1 .. P_K | v: P_1 .. P_K]      ...      l_L[u: P_1 .. P_K | v: P_1 .. P_K]   >
-		const int LOCI_START = num_loci * NUM_PARAMS * GetNumClusters();
-		const int PARAM_START = param_idx * NUM_PARAMS;
-		return LOCI_START + PARAM_START + num_cluster;
-	}
-
-	inline void Update(const BitGenosMatrix& genos, const Z& z)
-	{
-		for (int k = 0; k < GetNumClusters(); ++k) {
-			for (int l = 0; l < GetNumLoci(); ++l) {
-				FloatType sm_za = static_cast<FloatType>(0.0);
-				FloatType sm_zb = static_cast<FloatType>(0.0);
-				for (int n = 0; n < genos.GetNumIndivs(); ++n) {
-					const int G = genos.GetGeno(n, l);
-					const FloatType z_a = z.GetAssignment(n, 0, l, k);
-					const FloatType z_b = z.GetAssignment(n, 1, l, k);
-					const FloatType z_ab = z_a + z_b;
-					sm_za += (G == 1 ? z_a : 0) + (G == 2 ? z_ab : 0);
-					sm_zb += (G == 1 ? z_b : 0) + (G == 0 ? z_ab : 0);
-				}
-				SetFreq(l, k, 0, beta + sm_za);
-				SetFreq(l, k, 1, gamma + sm_zb);
-			}
-		}
-	}
-
-	inline void Update2(const BitGenosMatrix& genos, const Z& z)
-	{
-		for (int l = 0; l < GetNumLoci(); ++l) {
-			for (int k = 0; k < GetNumClusters(); ++k) {
-				FloatType sm_za = static_cast<FloatType>(0.0);
-				FloatType sm_zb = static_cast<FloatType>(0.0);
-				for (int n = 0; n < genos.GetNumIndivs(); ++n) {
-					const int G = genos.GetGeno(n, l);
-					const FloatType z_a = z.GetAssignment(n, 0, l, k);
-					const FloatType z_b = z.GetAssignment(n, 1, l, k);
-					const FloatType z_ab = z_a + z_b;
-					sm_za += (G == 1 ? z_a : 0) + (G == 2 ? z_ab : 0);
-					sm_zb += (G == 1 ? z_b : 0) + (G == 0 ? z_ab : 0);
-				}
-				SetFreq(l, k, 0, beta + sm_za);
-				SetFreq(l, k, 1, gamma + sm_zb);
-			}
-		}
-	}
-
-	int num_loci;
-	int num_clusters;
-	FloatType beta;
-	FloatType gamma;
 
-#ifdef USE_VECTOR
-	std::vector<std::vector<std::pair<FloatType, FloatType>>> freqs;
-#else
-	FloatType* freqs;
-#endif
-};
 
-struct Q
+static int CountMonomorphicLoci(const BitGenosMatrix& genos)
 {
-	Q() : num_indivs(0), num_clusters(0), alpha(0)
-#ifndef USE_VECTOR
-		, props(nullptr)
-#endif
-	{}
-
-	~Q()
-	{
-#ifndef USE_VECTOR
-		delete[] props; props = nullptr;
-#endif
-		num_indivs = num_clusters = 0;
-	}
-
-	inline void Init(int num_indivs, int num_clusters)
-	{
-		this->num_indivs = num_indivs;
-		this->num_clusters = num_clusters;
-		alpha = static_cast<FloatType>(1.0 / GetNumClusters());
-
-#ifdef USE_VECTOR
-		props.resize(GetNumIndivs());
-		for (int n = 0; n < GetNumIndivs(); ++n)
-			props[n].resize(GetNumClusters());
-#else
-		const int NUM_ELEMS = GetNumIndivs() * GetNumClusters();
-		props = new FloatType[NUM_ELEMS];
-#endif
-
-		// Initialize uniform.
-		for (int n = 0; n < GetNumIndivs(); ++n)
-			for (int k = 0; k < GetNumClusters(); ++k)
-				SetAdmixProp(n, k, static_cast<FloatType>(1.0 / GetNumClusters()));
-	}
-
-	inline FloatType GetAdmixProp(int indiv, int cluster) const
-	{
-#ifdef USE_VECTOR
-		return props[indiv][cluster];
-#else
-		return props[GetIdx(indiv, cluster)];
-#endif
-	}
-
-	inline void SetAdmixProp(int indiv, int cluster, FloatType val)
-	{
-#ifdef USE_VECTOR
-		props[indiv][cluster] = val;
-#else
-		props[GetIdx(indiv, cluster)] = val;
-#endif
-	}
-
-	inline int GetNumIndivs() const { return num_indivs; }
-	inline int GetNumClusters() const { return num_clusters; }
-	inline int GetIdx(int indiv, int cluster) const { return GetNumClusters() * indiv + cluster; }
-
-	inline void Update(const Z& z)
-	{
-		for (int n = 0; n < GetNumIndivs(); ++n) {
-			for (int k = 0; k < GetNumClusters(); ++k) {
-				FloatType sm_z_ab = static_cast<FloatType>(0.0);
-				for (int l = 0; l < z.GetNumLoci(); ++l)
-					sm_z_ab += z.GetAssignment(n, 0, l, k) + z.GetAssignment(n, 1, l, k);
-				SetAdmixProp(n, k, alpha + sm_z_ab);
-			}
-		}
+	int num_monomorphic = 0;
+	for (int l = 0; l < genos.GetNumLoci(); ++l) {
+		int counts[BitGenosMatrix::NUM_GENOTYPES];
+		genos.GetLocusCounts(l, counts);
+		num_monomorphic += std::max({ counts[0], counts[1], counts[2] }) == counts[0] + counts[1] + counts[2];
 	}
+	return num_monomorphic;
+}
 
-	inline FloatType GetQ0(int n) const
-	{
-		FloatType sm = static_cast<FloatType>(0.0);
-		for (int k = 0; k < GetNumClusters(); ++k)
-			sm += GetAdmixProp(n, k);
-		return sm;
-	}
+/// The LLBO gain is measured per genotype, so one epsilon fits every data size.
+inline static bool IsConverged(double new_LLBO, double old_LLBO, double num_genos, double epsilon)
+{
+	//if (new_LLBO < old_LLBO) return true;
+	const double DIFF = (new_LLBO - old_LLBO) / num_genos;
+	return DIFF < epsilon;
+}
 
-	inline int GetIndivCluster(int n) const
-	{
-		const FloatType Q_0 = GetQ0(n);
-		FloatType max_prop = static_cast<FloatType>(-1.0);
-		int max_k = -1;
-		for (int k = 0; k < GetNumClusters(); ++k) {
-			const FloatType PROP = GetAdmixProp(n, k) / Q_0;
-			if (max_prop < PROP) {
-				max_prop = PROP;
-				max_k = k;
-			}
+/// Log probabilities of genotypes 0 .. MISSING_GENO of loci [first_locus, last_locus) under each cluster,
+/// K values per genotype and (MISSING_GENO + 1) K per locus. A missing call has probability 1, so the
+/// genotype of an individual selects its row without a branch.
+static void GetGenoLogProbs(const Expectations& exps, int first_locus, int last_locus, std::vector<double>& table)
+{
+	const double LOG_2 = log(2);
+	const int K = exps.GetNumClusters();
+	table.resize(static_cast<size_t>(last_locus - first_locus) * (BitGenosMatrix::MISSING_GENO + 1) * K);
+	double* row = table.data();
+	for (int l = first_locus; l < last_locus; ++l, row += (BitGenosMatrix::MISSING_GENO + 1) * K) {
+		for (int k = 0; k < K; ++k) {
+			const double log_p_lk = exps.GetLogMeanP(l, k);
+			const double log_1_p_lk = exps.GetLogMean1P(l, k);
+			row[k] = log_1_p_lk + log_1_p_lk;
+			row[K + k] = LOG_2 + log_p_lk + log_1_p_lk;
+			row[2 * K + k] = log_p_lk + log_p_lk;
+			row[BitGenosMatrix::MISSING_GENO * K + k] = 0.0;
 		}
-		return max_k;
 	}
+}
 
-	int num_indivs;
-	int num_clusters;
-	FloatType alpha;
-
-#ifdef USE_VECTOR
-	std::vector<std::vector<FloatType>> props;
-#else
-	FloatType* props;
-#endif
-};
-
-
-
-void Z::Update(const BitGenosMatrix& genos, const P& p, const Q& q)
+/// Adds the log probability of the genotypes of loci [first_locus, last_locus) of individual n,
+/// if all of them came from cluster k, to log_probs[n K + k]. Missing calls are skipped.
+/// The loci go in blocks whose table fits in the L1 cache; each block is one parallel pass over the
+/// individuals, adding the K log probabilities of every call, in the same locus order for any thread count.
+template <typename Genos>
+static void AddLogProbs(const Genos& genos, const Expectations& exps, int first_locus, int last_locus,
+		std::vector<double>& log_probs, ThreadPool& pool)
 {
-	for (int n = 0; n < GetNumIndivs(); ++n) {
-		for (int l = 0; l < GetNumLoci(); ++l) {
-			FloatType q_0 = q.GetQ0(n);
-			for (int k = 0; k < GetNumClusters(); ++k) {
-				const int G = genos.GetGeno(n, l);
-				const FloatType p_u = p.GetFreq(l, k, 0);
-				const FloatType p_v = p.GetFreq(l, k, 1);
-				const FloatType q_n = q.GetAdmixProp(n, k);
-
-				const FloatType psi_a = (G == 0 ? digamma(p_v) : 0) +
-										(G == 1 ? digamma(p_u) : 0) +
-										(G == 2 ? digamma(p_u) : 0);
-
-				const FloatType psi_b = (G == 0 ? digamma(p_v) : 0) +
-										(G == 1 ? digamma(p_v) : 0) +
-										(G == 2 ? digamma(p_u) : 0);
-
-				const FloatType dg_p_uv = digamma(p_u + p_v);
-				const FloatType dg_q_n = digamma(q_n);
-				const FloatType dg_q_0 = digamma(q_0);
-				const FloatType z_a = exp(psi_a - dg_p_uv + dg_q_n - dg_q_0);
-				const FloatType z_b = exp(psi_b - dg_p_uv + dg_q_n - dg_q_0);
-				SetAssignment(n, 0, l, k, z_a);
-				SetAssignment(n, 1, l, k, z_b);
+	const int K = exps.GetNumClusters();
+	const int GENO_ELEMS = (BitGenosMatrix::MISSING_GENO + 1) * K;
+	const int BLOCK_LOCI = std::max(1, LOG_PROBS_BLOCK_ELEMS / GENO_ELEMS);
+	std::vector<double> table;
+	for (int first_l = first_locus; first_l < last_locus; first_l += BLOCK_LOCI) {
+		const int LAST_L = std::min(last_locus, first_l + BLOCK_LOCI);
+		GetGenoLogProbs(exps, first_l, LAST_L, table);
+		pool.ParallelFor(0, genos.GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+			for (int n = first_indiv; n < last_indiv; ++n) {
+				double* probs = &log_probs[static_cast<size_t>(n) * K];
+				const double* row = table.data();
+				for (int l = first_l; l < LAST_L; ++l, row += GENO_ELEMS) {
+					const double* ROW_G = row + genos.GetGeno(n, l) * K;
+					for (int k = 0; k < K; ++k)
+						probs[k] += ROW_G[k];
+				}
 			}
-		}
+		});
 	}
-	Normalize();
 }
 
-
-
-static void ReadGenotypes(std::ifstream& geno_file, uint32_t num_indivs, uint32_t num_loci, BitGenosMatrix& genos)
+/// Writes a line per individual: its normalised Q, most likely cluster, log probabilities and their arg max.
+/// Blocks of lines are formatted in parallel and written at once.
+static bool DumpVarParams(const std::string& path, const Q& q, const std::vector<double>& log_probs, ThreadPool& pool)
 {
-	int bit_num = 0, buff;
-	geno_file.read(reinterpret_cast<char*>(&buff), 1);
-	logger << Time << " Reading genotypes . . ." << std::endl;
-	for (unsigned i = 0; i < num_indivs; ++i) {
-		//logger << "#" << i << "     ";
-		for (unsigned l = 0; l < num_loci; ++l) {
-			if (bit_num == CHAR_BIT) {
-				geno_file.read(reinterpret_cast<char*>(&buff), 1);
-				bit_num = 0;
+	const int NUM_INDIVS = q.GetNumIndivs();
+	const int K = q.GetNumClusters();
+	const int NUM_CHUNKS = std::max(1, std::min(NUM_INDIVS, pool.GetNumThreads() * 4));
+	std::vector<std::string> chunks(NUM_CHUNKS);
+	pool.ParallelFor(0, NUM_CHUNKS, [&](int first_chunk, int last_chunk) {
+		char buf[64];
+		for (int c = first_chunk; c < last_chunk; ++c) {
+			std::string& text = chunks[c];
+			const int LAST_INDIV = static_cast<int>(static_cast<int64_t>(NUM_INDIVS) * (c + 1) / NUM_CHUNKS);
+			for (int n = static_cast<int>(static_cast<int64_t>(NUM_INDIVS) * c / NUM_CHUNKS); n < LAST_INDIV; ++n) {
+				text.append(buf, snprintf(buf, sizeof(buf), "%d     ", n));
+				const FloatType Q_0 = q.GetQ0(n);
+				for (int k = 0; k < K; ++k)
+					text.append(buf, snprintf(buf, sizeof(buf), "%g ", static_cast<double>(q.GetAdmixProp(n, k) / Q_0)));
+				text.append(buf, snprintf(buf, sizeof(buf), "      Q: %d     LogProbs: ", q.GetIndivCluster(n)));
+
+				double max_f = -std::numeric_limits<double>::max(); int max_k = -100;
+				for (int k = 0; k < K; ++k) {
+					const double LOG_PROB = log_probs[static_cast<size_t>(n) * K + k];
+					text.append(buf, snprintf(buf, sizeof(buf), "%g ", LOG_PROB));
+					if (max_f < LOG_PROB) {
+						max_f = LOG_PROB;
+						max_k = k;
+					}
+				}
+				text.append(buf, snprintf(buf, sizeof(buf), "     Z:%d\n", max_k));
 			}
-			const int G = (buff >> bit_num) & BitGenosMatrix::GENOTYPE_MASK;
-			//logger << G << ' ';
-			genos.SetGeno(i, l, G);
-			bit_num += BitGenosMatrix::BITS_PER_GENOTYPE;
 		}
-		//logger << std::endl;
-	}
-	logger << Time << " Reading is done!" << std::endl;
+	});
+
+	std::ofstream prop_file(path, std::ios_base::binary);
+	if (!prop_file.is_open())
+		return false;
+	for (const std::string& text : chunks)
+		prop_file.write(text.data(), text.size());
+	return static_cast<bool>(prop_file);
 }
 
-static double CalculateLLBO(const BitGenosMatrix& genos, const Z& z, const Q& q, const P& p)
+// Header of a binary props file, followed by uint32 version, int32 N, int32 K, the N x K normalised Q
+// and the N x K log probabilities of the individuals as doubles, native byte order.
+static constexpr char PROPS_FILE_MAGIC[8] = { 'V', 'B', 'P', 'R', 'O', 'P', 'S', '\0' };
+static constexpr uint32_t PROPS_FILE_VERSION = 1;
+
+/// Binary counterpart of DumpVarParams for --binary-props, written without formatting a number.
+static bool DumpBinaryProps(const std::string& path, const Q& q, const std::vector<double>& log_probs)
 {
-	const double LOG_BETA_B_G = LogBeta(p.beta, p.gamma);
+	std::ofstream props_file(path, std::ios_base::binary);
+	if (!props_file.is_open())
+		return false;
 
-	double LLBO = 0.0;
-	for (int l = 0; l < genos.GetNumLoci(); ++l) {
-		for (int n = 0; n < genos.GetNumIndivs(); ++n) {
-			const int G = genos.GetGeno(n, l);
-			for (int k = 0; k < z.GetNumClusters(); ++k) {
-				// E [[ Z_{nlk}^a ]]      E [[ Z_{nlk}^b ]]
-				const FloatType exp_za = genos.GetNumIndivs() * z.GetAssignment(n, 0, l, k);
-				const FloatType exp_zb = genos.GetNumIndivs() * z.GetAssignment(n, 1, l, k);
-				const double ent_za = z.GetEntropy(n, 0, l);
-				const double ent_zb = z.GetEntropy(n, 1, l);
-
-				// E [[ log(1 - P_{lk}) ]]     E [[ log(P_{lk}) ]]
-				const FloatType p_u = p.GetFreq(l, k, 0);
-				const FloatType p_v = p.GetFreq(l, k, 1);
-				const FloatType dg_p_uv = digamma(p_u + p_v);
-				const FloatType exp_1_Plk = digamma(p_v) - dg_p_uv;
-				const FloatType exp_Plk = digamma(p_u) - dg_p_uv;
-
-				// E [[ log Q_{nk} ]]
-				const FloatType exp_Qnk = digamma(q.GetAdmixProp(n, k)) - digamma(q.GetQ0(n));
-
-				const double z_ab = exp_za + exp_zb;
-				if (G == 0)
-					LLBO += z_ab * (exp_1_Plk);
-				else if (G == 2)
-					LLBO += z_ab * exp_Plk;
-				LLBO += z_ab * exp_Qnk;
-
-				if (G == 1)
-					LLBO += exp_za * exp_Plk + exp_zb * exp_1_Plk - ent_za - ent_zb;
-
-				const double BETA_RATIO = LogBeta(p_u, p_v) - LOG_BETA_B_G;
-				LLBO += BETA_RATIO + (p.beta - p_u) * exp_Plk + (p.gamma - p_v) * exp_1_Plk;
-			}
-		}
-	}
+	const int32_t NUM_INDIVS = q.GetNumIndivs();
+	const int32_t NUM_CLUSTERS = q.GetNumClusters();
+	props_file.write(PROPS_FILE_MAGIC, sizeof(PROPS_FILE_MAGIC));
+	props_file.write(reinterpret_cast<const char*>(&PROPS_FILE_VERSION), sizeof(PROPS_FILE_VERSION));
+	props_file.write(reinterpret_cast<const char*>(&NUM_INDIVS), sizeof(NUM_INDIVS));
+	props_file.write(reinterpret_cast<const char*>(&NUM_CLUSTERS), sizeof(NUM_CLUSTERS));
 
-	const double log_dg_alpha_0 = lgamma(q.alpha * q.GetNumClusters());
-	for (int n = 0; n < genos.GetNumIndivs(); ++n) {
-		const double q_n0 = q.GetQ0(n);
-		LLBO += lgamma(q_n0) - log_dg_alpha_0;
+	std::vector<double> props(static_cast<size_t>(NUM_INDIVS) * NUM_CLUSTERS);
+	for (int n = 0; n < NUM_INDIVS; ++n) {
+		const FloatType Q_0 = q.GetQ0(n);
+		for (int k = 0; k < NUM_CLUSTERS; ++k)
+			props[static_cast<size_t>(n) * NUM_CLUSTERS + k] = q.GetAdmixProp(n, k) / Q_0;
 	}
-	return LLBO;
+	props_file.write(reinterpret_cast<const char*>(props.data()), props.size() * sizeof(double));
+	props_file.write(reinterpret_cast<const char*>(log_probs.data()), log_probs.size() * sizeof(double));
+	return static_cast<bool>(props_file);
 }
 
-inline static bool IsConverged(double new_LLBO, double old_LLBO)
-{
-	//if (new_LLBO < old_LLBO) return true;
-	const double DIFF = new_LLBO - old_LLBO;
-	return DIFF < LLBO_EPSILON;
-}
+// Header of a binary P file, followed by uint32 version, int32 L, int32 K, double beta, double gamma and
+// the L x 2 x K Beta parameters (u_{l1} .. u_{lK}, v_{l1} .. v_{lK} per locus) as doubles, native byte order.
+static constexpr char P_FILE_MAGIC[8] = { 'V', 'B', 'F', 'R', 'E', 'Q', 'S', '\0' };
+static constexpr uint32_t P_FILE_VERSION = 1;
 
-inline double CalcLogProb(int indiv, int cluster, const BitGenosMatrix& genos, const Z& z, const P& p)
+/// Writes the variational P in double precision, so a float build can read the P of a double one and back.
+static bool DumpP(const std::string& path, const P& p)
 {
-	const double LOG_2 = log(2);
-	double prob = 0.0;
-	for (int l = 0; l < z.GetNumLoci(); ++l) {
-		const int G = genos.GetGeno(indiv, l);
-		const FloatType p_u = p.GetFreq(l, cluster, 0);
-		const FloatType p_lk = p_u / (p_u + p.GetFreq(l, cluster, 1));
-		if (G == 0)
-			prob += log(1.0 - p_lk) + log(1.0 - p_lk);
-		else if (G == 1)
-			prob += LOG_2 + log(p_lk) + log(1.0 - p_lk);
-		else
-			prob += log(p_lk) + log(p_lk);
+	std::ofstream p_file(path, std::ios_base::binary);
+	if (!p_file.is_open())
+		return false;
+
+	const int32_t NUM_LOCI = p.GetNumLoci();
+	const int32_t NUM_CLUSTERS = p.GetNumClusters();
+	const double BETA = p.beta;
+	const double GAMMA = p.gamma;
+	p_file.write(P_FILE_MAGIC, sizeof(P_FILE_MAGIC));
+	p_file.write(reinterpret_cast<const char*>(&P_FILE_VERSION), sizeof(P_FILE_VERSION));
+	p_file.write(reinterpret_cast<const char*>(&NUM_LOCI), sizeof(NUM_LOCI));
+	p_file.write(reinterpret_cast<const char*>(&NUM_CLUSTERS), sizeof(NUM_CLUSTERS));
+	p_file.write(reinterpret_cast<const char*>(&BETA), sizeof(BETA));
+	p_file.write(reinterpret_cast<const char*>(&GAMMA), sizeof(GAMMA));
+
+	std::vector<double> row(P::NUM_PARAMS * p.GetNumClusters());
+	for (int l = 0; l < p.GetNumLoci(); ++l) {
+		for (int i = 0; i < P::NUM_PARAMS; ++i)
+			for (int k = 0; k < p.GetNumClusters(); ++k)
+				row[i * p.GetNumClusters() + k] = p.GetFreq(l, k, i);
+		p_file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(double));
 	}
-	return prob;
+	return static_cast<bool>(p_file);
 }
 
-inline static void DumpVarParams(const BitGenosMatrix& genos, const Z& z, const Q& q, const P& p)
+static bool ReadP(const std::string& path, P& p)
 {
-	logger << Time << " Dumping variational parameters . . ." << std::endl;
+	std::ifstream p_file(path, std::ios_base::binary);
+	if (!p_file.is_open())
+		return false;
 
-	std::ofstream prop_file(DUMP_PATH + "props.txt");
-	if (!prop_file.is_open()) {
-		logger << Time << ' ' << warning << " Could not open output file for dumping variational parameters!" << std::endl;
-		return;
-	}
+	char magic[sizeof(P_FILE_MAGIC)];
+	uint32_t version = 0;
+	int32_t num_loci = 0, num_clusters = 0;
+	double beta = 0, gamma = 0;
+	p_file.read(magic, sizeof(magic));
+	p_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	p_file.read(reinterpret_cast<char*>(&num_loci), sizeof(num_loci));
+	p_file.read(reinterpret_cast<char*>(&num_clusters), sizeof(num_clusters));
+	p_file.read(reinterpret_cast<char*>(&beta), sizeof(beta));
+	p_file.read(reinterpret_cast<char*>(&gamma), sizeof(gamma));
+	if (!p_file || memcmp(magic, P_FILE_MAGIC, sizeof(magic)) != 0 || version != P_FILE_VERSION
+			|| num_loci <= 0 || num_clusters <= 0)
+		return false;
 
-	for (int n = 0; n < q.GetNumIndivs(); ++n) {
-		prop_file << n << "     ";
-		const FloatType Q_0 = q.GetQ0(n);
-		for (int k = 0; k < q.GetNumClusters(); ++k)
-			prop_file << q.GetAdmixProp(n, k) / Q_0 << ' ';
-		prop_file << "      Q: " << q.GetIndivCluster(n) << "     LogProbs: ";
-
-		double max_f = -std::numeric_limits<double>::max(); int max_k = -100;
-		for (int k = 0; k < z.GetNumClusters(); ++k) {
-			const double LOG_PROB = CalcLogProb(n, k, genos, z, p);
-			prop_file << LOG_PROB << ' ';
-			if (max_f < LOG_PROB) {
-				max_f = LOG_PROB;
-				max_k = k;
-			}
-		}
-		prop_file << "     Z:" << max_k << std::endl;
+	p.Init(num_loci, num_clusters);
+	p.beta = static_cast<FloatType>(beta);
+	p.gamma = static_cast<FloatType>(gamma);
+	std::vector<double> row(P::NUM_PARAMS * p.GetNumClusters());
+	for (int l = 0; l < p.GetNumLoci(); ++l) {
+		if (!p_file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(double)))
+			return false;
+		for (int i = 0; i < P::NUM_PARAMS; ++i)
+			for (int k = 0; k < p.GetNumClusters(); ++k)
+				p.SetFreq(l, k, i, static_cast<FloatType>(row[i * p.GetNumClusters() + k]));
 	}
-
-	logger << Time << " Dumping is done!" << std::endl;
+	return true;
 }
 
 inline static bool DumpFreqs(std::string path, FreqsVector& freqs)
@@ -735,7 +447,8 @@ inline bool InitGenos(BitGenosMatrix& genos, const FreqsVector& freqs, int num_i
 {
 	if (IsFileExist(GENOS_PATH)) {
 		logger << Time << " Genotype file exists . . ." << std::endl;
-		return genos.ReadFromTextFile(GENOS_PATH);
+		ThreadPool pool;
+		return TextGenosFile::ReadFastStructure(GENOS_PATH, genos, pool);
 	}
 
 	logger << Time << " Making genotype file . . ." << std::endl;
@@ -756,152 +469,1905 @@ inline bool InitGenos(BitGenosMatrix& genos, const FreqsVector& freqs, int num_i
 	return genos.DumpText(GENOS_PATH);
 }
 
-inline static void LogIterations(int itr, int MAX_ITERS, double old_llbo)
+inline static void LogIterations(int itr, int max_iters, double llbo, bool has_llbo)
 {
-	(void) MAX_ITERS;
-#ifdef USE_LLBO
-	//logger << "LLBO:" << old_LLBO << std::endl;
-#endif
+	(void) max_iters;
 
-	if (itr % ITER_REPORT == 0)
-		logger << Time << " itr #" << itr << "     LLBO:" <<
-#ifdef USE_LLBO
-		old_llbo
-#else
-		"NOT USED"
-#endif
-		<< std::endl;
+	if (itr % ITER_REPORT == 0) {
+		logger << Time << " itr #" << itr << "     LLBO:";
+		if (has_llbo)
+			logger << llbo << std::endl;
+		else
+			logger << "NOT USED" << std::endl;
+	}
 }
 
+/// Accuracy of the clustering against the true clusters of simulated genotypes, N / K consecutive individuals each:
+/// the share of individuals whose cluster matches under the best labelling of the found clusters.
 inline static void CalcAcc(const Q& q)
 {
-	std::vector<std::vector<int>> cluster_count(q.GetNumClusters(),
-		std::vector<int>(q.GetNumClusters(), 0));
-
-	// Count clusters.
-	const int NUM_INDIVS_IN_CLUSTER = q.GetNumIndivs() / q.GetNumClusters();
-	for (int k = 0; k < q.GetNumClusters(); ++k)
-		for (int i = 0; i < NUM_INDIVS_IN_CLUSTER; ++i)
-			++cluster_count[k][q.GetIndivCluster(k * NUM_INDIVS_IN_CLUSTER + i)];
-
-	std::vector<int> perm(q.GetNumClusters());
-	for (int i = 0; i < q.GetNumClusters(); ++i)
-		perm[i] = i;
-
-	// Calculate accuracies and find maximum one for report.
-	std::vector<double> accs;
-	do {
-		double sm = 0.0;
-		for (int k = 0; k < q.GetNumClusters(); ++k)
-			sm += cluster_count[k][perm[k]];
-		const double ACC = sm / static_cast<double>(q.GetNumIndivs());
-		accs.push_back(ACC);
-	} while (std::next_permutation(perm.begin(), perm.end()));
-
-	logger << Time << " Acc: " << *std::max_element(accs.begin(), accs.end()) << "   [ ";
-	for (const auto& a : accs)
-		logger << a << ' ';
+	const int K = q.GetNumClusters();
+	const int NUM_INDIVS_IN_CLUSTER = q.GetNumIndivs() / K;
+	std::vector<int> true_clusters(q.GetNumIndivs(), -1), found_clusters(q.GetNumIndivs());
+	for (int n = 0; n < q.GetNumIndivs(); ++n) {
+		if (n < K * NUM_INDIVS_IN_CLUSTER)
+			true_clusters[n] = n / NUM_INDIVS_IN_CLUSTER;
+		found_clusters[n] = q.GetIndivCluster(n);
+	}
+
+	std::vector<std::vector<double>> confusion;
+	std::vector<int> mapping;
+	CountConfusion(true_clusters, found_clusters, K, K, confusion);
+	const double ACC = MatchClusters(confusion, mapping) / static_cast<double>(q.GetNumIndivs());
+
+	logger << Time << " Acc: " << ACC << "   [ ";
+	for (int k = 0; k < K; ++k)
+		logger << k << "->" << mapping[k] << ' ';
 	logger << ']' << std::endl;
+	logger << "  Confusion (true x found cluster):" << std::endl;
+	for (int t = 0; t < K; ++t) {
+		logger << "    " << t << ':';
+		for (int f = 0; f < K; ++f)
+			logger << ' ' << confusion[t][f];
+		logger << std::endl;
+	}
 }
 
 
 
-int main(int argc, char** argv)
+struct VBOptions
 {
-	logger << std::endl << std::endl;
-	logger << "===== VB STRUCT =====" << std::endl;
-	logger << "Start : " << Time << std::endl;
-	logger << "MAX_ITERS    : " << MAX_ITERS << std::endl;
-	logger << "MIN_ITERS    : " << MIN_ITERS << std::endl;
-	//logger << "LLBO_UPDATE  : " << LLBO_UPDATE << std::endl;
-	logger << "LLBO_EPSILON : " << LLBO_EPSILON << std::endl;
-	logger << "sizeof(int)  : " << sizeof(int) << std::endl;
-	logger << "USE VECTOR   : " << (USE_VECTOR ? "TRUE" : "FALSE") << std::endl;
-	logger << std::endl;
+	VBOptions()
+		: genos_path(nullptr), num_threads(0), is_streaming(false)
+		, max_iters(MAX_ITERS), min_iters(MIN_ITERS), llbo_every(LLBO_UPDATE), epsilon(LLBO_EPSILON)
+		, min_clusters(0), max_clusters(0), num_restarts(1), seed(0), is_accelerated(false)
+		, svi_batch(0), svi_tau(SVI_TAU), svi_kappa(SVI_KAPPA), block_loci(OOC_BLOCK_LOCI), pack_path(nullptr)
+		, checkpoint_path(nullptr), checkpoint_every(0), checkpoint_seconds(CHECKPOINT_SECONDS), is_resuming(false)
+		, project_path(nullptr), is_binary_props(false), is_timing(false), num_folds(0), cv_fraction(0)
+		, is_shared_genos(false)
+	{}
 
-	if (argc < 2) {
-		logger << "File name is required!" << std::endl;
-		return 1;
-	}
+	inline bool IsSweep() const { return max_clusters > 0; }
+	inline bool IsCrossValidation() const { return num_folds > 0; }
+
+	const char* genos_path;
+	int num_threads;
+	bool is_streaming;
+	int max_iters;
+	int min_iters;
+	int llbo_every;
+	double epsilon;
+	int min_clusters;		// K range of --sweep, 0 for a single run with the K of the genotype file.
+	int max_clusters;
+	int num_restarts;
+	uint64_t seed;			// Base seed of every initialization, 0 to draw one.
+	bool is_accelerated;
+	int svi_batch;			// Individuals per minibatch of stochastic VI, 0 for batch VI.
+	double svi_tau;
+	double svi_kappa;
+	int block_loci;			// Loci per block of a memory-mapped genotype file.
+	const char* pack_path;	// Write the genotypes to this packed file and exit.
+	const char* checkpoint_path;
+	int checkpoint_every;	// Iterations between checkpoints, 0 for only checkpoint_seconds.
+	double checkpoint_seconds;
+	bool is_resuming;
+	const char* project_path;	// P file of an earlier fit, fit only Q of the genotypes against it.
+	bool is_binary_props;	// Dump Q and the log probabilities to props*.bin instead of props*.txt.
+	bool is_timing;			// Stream the phase times of every iteration to timings.jsonl.
+	int num_folds;			// Cross-validation folds of --cv, 0 for none.
+	double cv_fraction;		// Share of the genotype entries each fold holds out.
+	bool is_shared_genos;	// Set by the runs: several jobs read the genotypes at once.
+};
 
-#ifdef READ_GENOTYPES_FROM_BINARY_FILE
-	std::ifstream geno_file(argv[1], std::ios_base::binary);
-	if (!geno_file.is_open()) {
-		logger << "Could not open input file!" << std::endl;
-		return 2;
-	}
-
-	// Read header.
-	logger << "Genotype file `" << argv[1] << "' is opened!" << std::endl;
-	uint32_t num_clusters, num_loci, num_indivs;
-	geno_file.read(reinterpret_cast<char*>(&num_clusters), sizeof(num_clusters));
-	geno_file.read(reinterpret_cast<char*>(&num_loci), sizeof(num_loci));
-	geno_file.read(reinterpret_cast<char*>(&num_indivs), sizeof(num_indivs));
-	logger << "Header ->     <K:" << num_clusters << ">    <L:" << num_loci << ">   <N:" << num_indivs << ">" << std::endl;
-
-	// Read genotypes.
-	BitGenosMatrix genos(num_indivs, num_loci);
-	ReadGenotypes(geno_file, num_indivs, num_loci, genos);
-#elifdef MAKE_RANDOM_FREQS
-	//Make frequencies.
-	FreqsVector freqs;
-	InitFreqs(freqs, NUM_CLUSTERS, NUM_LOCI);
+static void PrintUsage(const char* exe_name)
+{
+	logger << "Usage: " << exe_name << " <genotype-file> [--threads N] [--stream] [--max-iters N] [--min-iters N]"
+		<< " [--llbo-every M] [--epsilon E] [--sweep KMIN KMAX] [--restarts R] [--seed S] [--accelerate]"
+		<< " [--svi B [--svi-tau T] [--svi-kappa K]] [--block-loci B] [--pack PATH]"
+		<< " [--checkpoint PATH [--checkpoint-every M] [--checkpoint-seconds T] [--resume]] [--project P-FILE] [--binary-props] [--timings]"
+		<< " [--cv F [--cv-fraction R]]" << std::endl;
+	logger << "  The genotype file is a text file, a PLINK .bed file next to its .bim and .fam, or a packed file" << std::endl;
+	logger << "  written by --pack. Packed and .bed files are memory-mapped and" << std::endl;
+	logger << "  processed out of core, one block of loci at a time. With --accelerate or --svi they are" << std::endl;
+	logger << "  copied into memory instead, after checking its checksum." << std::endl;
+	logger << "  --threads N    Number of worker threads (default: all hardware threads)." << std::endl;
+	logger << "  --stream       Z-free mode, compute assignments on the fly instead of storing N x L x K x 2 of them." << std::endl;
+	logger << "  --max-iters N  Maximum number of iterations (default: " << MAX_ITERS << ")." << std::endl;
+	logger << "  --min-iters N  Iterations to run before convergence is checked (default: " << MIN_ITERS << ")." << std::endl;
+	logger << "  --llbo-every M Evaluate the LLBO every M iterations, 0 never (default: " << LLBO_UPDATE << ")." << std::endl;
+	logger << "  --epsilon E    Stop when the LLBO gains less than E per genotype (default: " << LLBO_EPSILON << ")." << std::endl;
+	logger << "  --sweep KMIN KMAX" << std::endl;
+	logger << "                 Fit every K in [KMIN, KMAX] concurrently on the same genotypes, dump props_K<K>.txt" << std::endl;
+	logger << "                 for each and the LLBO of all of them to sweep.txt." << std::endl;
+	logger << "  --restarts R   Fit each K from R seeded initializations in parallel and keep the one with the" << std::endl;
+	logger << "                 best LLBO (default: 1). Add --stream to keep every restart at the size of P and Q." << std::endl;
+	logger << "  --seed S       Base seed of the initializations (default: random)." << std::endl;
+	logger << "  --accelerate   Extrapolate P and Q with SQUAREM, falling back to the plain step when the LLBO" << std::endl;
+	logger << "                 decreases. Implies --stream, the LLBO is evaluated once per 3 iterations." << std::endl;
+	logger << "  --svi B        Stochastic VI on minibatches of B individuals, P steps with rate (T + t)^-K." << std::endl;
+	logger << "                 An iteration is one pass over the individuals. Implies --stream." << std::endl;
+	logger << "  --svi-tau T    Delay of the SVI learning rate (default: " << SVI_TAU << ")." << std::endl;
+	logger << "  --svi-kappa K  Forgetting rate of the SVI learning rate, in (0.5, 1] (default: " << SVI_KAPPA << ")." << std::endl;
+	logger << "  --block-loci B Loci per block of a packed genotype file (default: " << OOC_BLOCK_LOCI << ")." << std::endl;
+	logger << "  --pack PATH    Write the text or .bed genotype file to PATH in the packed format and exit." << std::endl;
+	logger << "  --checkpoint PATH" << std::endl;
+	logger << "                 Save P, Q and the iteration state to PATH, or PATH.K<K>.R<restart> when several fits" << std::endl;
+	logger << "                 run, every M iterations or T seconds and when a fit ends." << std::endl;
+	logger << "  --checkpoint-every M" << std::endl;
+	logger << "                 Iterations between checkpoints, 0 for time only (default: 0)." << std::endl;
+	logger << "  --checkpoint-seconds T" << std::endl;
+	logger << "                 Seconds between checkpoints, 0 for iterations only (default: " << CHECKPOINT_SECONDS << ")." << std::endl;
+	logger << "  --resume       Continue every fit from its checkpoint, with the same options, as if never stopped." << std::endl;
+	logger << "  --project P-FILE" << std::endl;
+	logger << "                 Estimate only Q of the individuals in the genotype file against the fixed P of an earlier" << std::endl;
+	logger << "                 fit of the same loci, p.bin or p_K<K>.bin, and dump it to props_projected.txt." << std::endl;
+	logger << "  --binary-props Dump Q and the log probabilities of the individuals to props*.bin, N x K doubles each," << std::endl;
+	logger << "                 instead of props*.txt." << std::endl;
+	logger << "  --timings      Write the time of the Z, Q, P, expectation, LLBO and checkpoint phases, the throughput," << std::endl;
+	logger << "                 the LLBO change and the resident memory of every iteration to timings.jsonl." << std::endl;
+	logger << "  --cv F         Cross-validate every K of the sweep, or the K of the genotype file, on F folds. Each fold" << std::endl;
+	logger << "                 holds out a random share of the genotype entries, fits the rest with streamed iterations" << std::endl;
+	logger << "                 and scores the held-out deviance. Folds and Ks run concurrently on the same genotypes;" << std::endl;
+	logger << "                 the Ks are ranked by their mean deviance and every fit is written to cv.txt." << std::endl;
+	logger << "  --cv-fraction R" << std::endl;
+	logger << "                 Share of the entries each fold holds out, disjoint while F R <= 1 (default: min("
+		<< CV_FRACTION << ", 1 / F))." << std::endl;
+}
 
-	// Make genotypes.
-	InitGenos(genos, freqs, NUM_INDIVS, NUM_LOCI);
-#else
-	logger << Time << " Reading from text file -> " << argv[1] << std::endl;
-	BitGenosMatrix genos;
-	if (!genos.ReadFromTextFile(argv[1])) {
-		logger << "Could not open `" << argv[1] << "' file!" << std::endl;
-		return 2;
+static bool ParseOptions(int argc, char** argv, VBOptions& opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		const std::string ARG = argv[i];
+		if (ARG == "--threads" && i + 1 < argc)
+			opts.num_threads = std::atoi(argv[++i]);
+		else if (ARG == "--stream")
+			opts.is_streaming = true;
+		else if (ARG == "--max-iters" && i + 1 < argc)
+			opts.max_iters = std::atoi(argv[++i]);
+		else if (ARG == "--min-iters" && i + 1 < argc)
+			opts.min_iters = std::atoi(argv[++i]);
+		else if (ARG == "--llbo-every" && i + 1 < argc)
+			opts.llbo_every = std::atoi(argv[++i]);
+		else if (ARG == "--epsilon" && i + 1 < argc)
+			opts.epsilon = std::atof(argv[++i]);
+		else if (ARG == "--sweep" && i + 2 < argc) {
+			opts.min_clusters = std::atoi(argv[++i]);
+			opts.max_clusters = std::atoi(argv[++i]);
+			if (opts.min_clusters < 1 || opts.max_clusters < opts.min_clusters) {
+				logger << "Invalid K range [" << opts.min_clusters << ", " << opts.max_clusters << "]!" << std::endl;
+				return false;
+			}
+		}
+		else if (ARG == "--accelerate")
+			opts.is_accelerated = opts.is_streaming = true;
+		else if (ARG == "--svi" && i + 1 < argc) {
+			opts.svi_batch = std::max(1, std::atoi(argv[++i]));
+			opts.is_streaming = true;
+		} else if (ARG == "--svi-tau" && i + 1 < argc)
+			opts.svi_tau = std::atof(argv[++i]);
+		else if (ARG == "--svi-kappa" && i + 1 < argc)
+			opts.svi_kappa = std::atof(argv[++i]);
+		else if (ARG == "--block-loci" && i + 1 < argc)
+			opts.block_loci = std::max(1, std::atoi(argv[++i]));
+		else if (ARG == "--pack" && i + 1 < argc)
+			opts.pack_path = argv[++i];
+		else if (ARG == "--checkpoint" && i + 1 < argc)
+			opts.checkpoint_path = argv[++i];
+		else if (ARG == "--checkpoint-every" && i + 1 < argc)
+			opts.checkpoint_every = std::max(0, std::atoi(argv[++i]));
+		else if (ARG == "--checkpoint-seconds" && i + 1 < argc)
+			opts.checkpoint_seconds = std::atof(argv[++i]);
+		else if (ARG == "--resume")
+			opts.is_resuming = true;
+		else if (ARG == "--project" && i + 1 < argc)
+			opts.project_path = argv[++i];
+		else if (ARG == "--binary-props")
+			opts.is_binary_props = true;
+		else if (ARG == "--timings")
+			opts.is_timing = true;
+		else if (ARG == "--cv" && i + 1 < argc) {
+			opts.num_folds = std::atoi(argv[++i]);
+			if (opts.num_folds < 1) {
+				logger << "Invalid number of folds " << opts.num_folds << "!" << std::endl;
+				return false;
+			}
+		} else if (ARG == "--cv-fraction" && i + 1 < argc) {
+			opts.cv_fraction = std::atof(argv[++i]);
+			if (!(opts.cv_fraction > 0 && opts.cv_fraction < 1)) {
+				logger << "Invalid held-out fraction " << opts.cv_fraction << ", it must be in (0, 1)!" << std::endl;
+				return false;
+			}
+		}
+		else if (ARG == "--restarts" && i + 1 < argc)
+			opts.num_restarts = std::max(1, std::atoi(argv[++i]));
+		else if (ARG == "--seed" && i + 1 < argc)
+			opts.seed = std::strtoull(argv[++i], nullptr, 10);
+		else if (ARG[0] != '-' && opts.genos_path == nullptr)
+			opts.genos_path = argv[i];
+		else {
+			logger << "Invalid argument `" << ARG << "'!" << std::endl;
+			return false;
+		}
 	}
-#endif
+	if (opts.is_resuming && opts.checkpoint_path == nullptr) {
+		logger << "--resume needs --checkpoint!" << std::endl;
+		return false;
+	}
+	if (opts.IsCrossValidation() && opts.project_path != nullptr) {
+		logger << "--cv and --project can not be combined!" << std::endl;
+		return false;
+	}
+	if (opts.IsCrossValidation() && opts.cv_fraction == 0)
+		opts.cv_fraction = std::min(CV_FRACTION, 1.0 / opts.num_folds);
+	return opts.genos_path != nullptr;
+}
 
-	logger << Time << "Reading genotype file is done!" << std::endl;
-	logger << "  NumIndivs:   " << genos.GetNumIndivs() << std::endl;
-	logger << "  NumLoci:     " << genos.GetNumLoci() << std::endl;
-	logger << "  NumClusters: " << genos.GetNumClusters() << std::endl;
 
-	// Initialize parameters.
-	logger << Time << " Initialize P, Z, and Q . . ." << std::endl;
-	P p; p.Init(genos.GetNumLoci(), genos.GetNumClusters());
-	Z z; z.Init(genos.GetNumIndivs(), genos.GetNumLoci(), genos.GetNumClusters());
-	Q q; q.Init(genos.GetNumIndivs(), genos.GetNumClusters());
 
-#ifdef MAKE_RANDOM_FREQS
-	freqs.clear();		// Clear useless frequencies.
-#endif
-	
-	logger << Time << " Start iterations . . ." << std::endl;
+/// Outcome of fitting one K from one initialization.
+struct VBResult
+{
+	VBResult() : num_clusters(0), restart(0), seed(0), num_iters(0), is_converged(false), llbo(0), seconds(0) {}
 
-	double old_LLBO =
-#ifdef USE_LLBO
-		CalculateLLBO(genos, z, q, p);
-#else
-		0;
-#endif
+	int num_clusters;
+	int restart;
+	uint64_t seed;
+	int num_iters;
+	bool is_converged;
+	double llbo;
+	double seconds;
+};
 
-	for (int itr = 0; itr < MAX_ITERS; ++itr) {
-		LogIterations(itr, MAX_ITERS, old_LLBO);
+/// Variational parameters left after a fit. Z is only needed while fitting, so it is not kept.
+struct VBFit
+{
+	VBResult result;
+	P p;
+	Q q;
+	Expectations exps;
+};
+
+/// Seed of restart `restart' of K `num_clusters', mixed so that nearby base seeds do not share initializations.
+inline static uint64_t GetFitSeed(uint64_t seed, int num_clusters, int restart)
+{
+	uint64_t state = seed ^ (static_cast<uint64_t>(num_clusters) << 32 | static_cast<uint64_t>(restart));
+	return RandomZ::NextRandom(state);
+}
+
+/// Kind of iteration a fit runs. A checkpoint only resumes the same kind.
+enum VBMode
+{
+	VB_STORED,
+	VB_STREAMED,			// In memory or out of core, both keep only P and Q.
+	VB_SQUAREM,
+	VB_SVI,
+	VB_PROJECTION,			// Only Q, against a fixed P.
+};
+
+inline static VBMode GetVBMode(const VBOptions& opts)
+{
+	if (opts.project_path != nullptr)
+		return VB_PROJECTION;
+	if (opts.svi_batch > 0)
+		return VB_SVI;
+	if (opts.is_accelerated)
+		return VB_SQUAREM;
+	return opts.is_streaming ? VB_STREAMED : VB_STORED;
+}
+
+/// Iteration state besides P and Q that a fit needs to continue bit-exactly.
+struct VBState
+{
+	VBState(VBMode mode)
+		: mode(mode), num_iters(0), is_converged(false), is_llbo_current(false), llbo(0)
+		, svi_step(0), num_accepted(0), num_rejected(0), num_plain(0)
+	{}
+
+	VBMode mode;
+	int num_iters;
+	bool is_converged;		// A resumed converged fit is only reloaded.
+	bool is_llbo_current;	// llbo belongs to the current P and Q.
+	double llbo;			// Last evaluated LLBO.
+	long long svi_step;
+	int num_accepted;		// SQUAREM jumps kept.
+	int num_rejected;		// SQUAREM jumps rolled back because the LLBO went down.
+	int num_plain;			// SQUAREM cycles without a valid jump to try, which keep the plain step.
+	std::string rng_state;	// SVI shuffle generator.
+	ParamsTensor q_prev;	// Q the stored Z was computed from, the stored mode rebuilds Z from it.
+};
+
+/// Periodic binary checkpoints of one fit. Serializing P and Q is a copy in the compute thread; the
+/// file is written by a background thread, so the iterations go on while it reaches the disk.
+///
+/// Layout, native byte order: CHECKPOINT_MAGIC, uint32 version, uint32 sizeof(FloatType), the sizes
+/// and VBState fields in declaration order, then the P, Q and q_prev tensors as uint64 size + data.
+class Checkpointer
+{
+public:
+	static constexpr char MAGIC[8] = { 'V', 'B', 'C', 'K', 'P', 'T', '\0', '\0' };
+	static constexpr uint32_t VERSION = 2;
+
+	Checkpointer(const std::string& path, int every_iters, double every_seconds)
+		: path(path), every_iters(every_iters), every_seconds(every_seconds), last_save_iters(0)
+		, last_save(std::chrono::steady_clock::now())
+	{}
+
+	inline const std::string& GetPath() const { return path; }
+
+	/// True if every_iters iterations or every_seconds seconds have passed and the previous write is done.
+	inline bool IsDue(int num_iters) const
+	{
+		if (writer.IsBusy())
+			return false;
+		const double SECONDS = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_save).count();
+		return (every_iters > 0 && num_iters - last_save_iters >= every_iters) || (every_seconds > 0 && SECONDS >= every_seconds);
+	}
+
+	/// Starts writing a checkpoint in the background, or writes it before returning if `is_sync' is true.
+	inline bool Save(const VBFit& fit, const VBState& state, bool is_sync)
+	{
+		std::vector<char> buf;
+		Serialize(fit, state, buf);
+		last_save_iters = state.num_iters;
+		last_save = std::chrono::steady_clock::now();
+		if (is_sync)
+			return writer.Wait() && BackgroundFileWriter::WriteAtomic(path, buf);
+		return writer.TryWrite(path, buf);
+	}
 
-		p.Update(genos, z);			// Update P
-		z.Update(genos, p, q);		// Update Z
-		q.Update(z);				// Update Q
+	/// Waits for the background write, false if one of them failed.
+	inline bool Wait() { return writer.Wait(); }
 
-#ifdef USE_LLBO
-		const double NEW_LLBO = CalculateLLBO(genos, z, q, p);
-		if (IsConverged(NEW_LLBO, old_LLBO) && itr > MIN_ITERS) {
-			logger << Time << " Converged at #" << itr << " iteration!         "
-				<< "new LLBO:" << NEW_LLBO << "     old LLBO:" << old_LLBO << std::endl;
-			break;
+	/// Reads P, Q and `state' of a fit of the same size and mode. P, Q and state.q_prev must be initialized.
+	/// Nothing is changed if the checkpoint does not match.
+	inline bool Load(VBFit& fit, VBState& state) const
+	{
+		std::vector<char> buf;
+		if (!BackgroundFileWriter::ReadFile(path, buf))
+			return false;
+
+		size_t pos = 0;
+		char magic[sizeof(MAGIC)];
+		uint32_t version = 0, float_size = 0;
+		int num_indivs = 0, num_loci = 0, num_clusters = 0, mode = -1;
+		uint64_t seed = 0;
+		VBState loaded(state.mode);
+		bool is_ok = Get(buf, pos, magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0
+			&& Get(buf, pos, version) && version == VERSION && Get(buf, pos, float_size) && float_size == sizeof(FloatType)
+			&& Get(buf, pos, num_indivs) && num_indivs == fit.q.GetNumIndivs()
+			&& Get(buf, pos, num_loci) && num_loci == fit.p.GetNumLoci()
+			&& Get(buf, pos, num_clusters) && num_clusters == fit.q.GetNumClusters()
+			&& Get(buf, pos, mode) && mode == state.mode
+			&& Get(buf, pos, seed) && Get(buf, pos, loaded.num_iters)
+			&& Get(buf, pos, loaded.is_converged) && Get(buf, pos, loaded.is_llbo_current) && Get(buf, pos, loaded.llbo)
+			&& Get(buf, pos, loaded.svi_step) && Get(buf, pos, loaded.num_accepted) && Get(buf, pos, loaded.num_rejected)
+			&& Get(buf, pos, loaded.num_plain);
+
+		uint64_t rng_size = 0;
+		is_ok = is_ok && Get(buf, pos, rng_size) && rng_size <= buf.size() - pos;
+		if (is_ok) {
+			loaded.rng_state.assign(buf.data() + pos, rng_size);
+			pos += rng_size;
 		}
-		old_LLBO = NEW_LLBO;
+
+		ParamsTensor freqs = fit.p.freqs, props = fit.q.props;
+		loaded.q_prev = state.q_prev;
+		is_ok = is_ok && GetTensor(buf, pos, freqs) && GetTensor(buf, pos, props) && GetTensor(buf, pos, loaded.q_prev)
+			&& pos == buf.size();
+		if (!is_ok)
+			return false;
+
+		fit.result.seed = seed;
+		fit.p.freqs = std::move(freqs);
+		fit.q.props = std::move(props);
+		state = std::move(loaded);
+		return true;
+	}
+
+private:
+	template <typename T>
+	static inline void Put(std::vector<char>& buf, const T& x)
+	{
+		const char* BYTES = reinterpret_cast<const char*>(&x);
+		buf.insert(buf.end(), BYTES, BYTES + sizeof(T));
+	}
+
+	template <typename T>
+	static inline bool Get(const std::vector<char>& buf, size_t& pos, T& x)
+	{
+		if (buf.size() - pos < sizeof(T))
+			return false;
+		memcpy(&x, buf.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	static inline void PutTensor(std::vector<char>& buf, const ParamsTensor& t)
+	{
+		Put(buf, static_cast<uint64_t>(t.GetSize()));
+		const char* BYTES = reinterpret_cast<const char*>(t.GetData());
+		buf.insert(buf.end(), BYTES, BYTES + t.GetSize() * sizeof(FloatType));
+	}
+
+	/// The tensor keeps its dimensions, the stored one must have the same number of elements.
+	static inline bool GetTensor(const std::vector<char>& buf, size_t& pos, ParamsTensor& t)
+	{
+		uint64_t size = 0;
+		if (!Get(buf, pos, size) || size != t.GetSize() || (buf.size() - pos) / sizeof(FloatType) < size)
+			return false;
+		if (size)
+			memcpy(t.GetData(), buf.data() + pos, size * sizeof(FloatType));
+		pos += size * sizeof(FloatType);
+		return true;
+	}
+
+	static inline void Serialize(const VBFit& fit, const VBState& state, std::vector<char>& buf)
+	{
+		buf.reserve(256 + state.rng_state.size()
+			+ (fit.p.freqs.GetSize() + fit.q.props.GetSize() + state.q_prev.GetSize()) * sizeof(FloatType));
+		buf.insert(buf.end(), MAGIC, MAGIC + sizeof(MAGIC));
+		Put(buf, VERSION);
+		Put(buf, static_cast<uint32_t>(sizeof(FloatType)));
+		Put(buf, fit.q.GetNumIndivs());
+		Put(buf, fit.p.GetNumLoci());
+		Put(buf, fit.q.GetNumClusters());
+		Put(buf, static_cast<int>(state.mode));
+		Put(buf, fit.result.seed);
+		Put(buf, state.num_iters);
+		Put(buf, state.is_converged);
+		Put(buf, state.is_llbo_current);
+		Put(buf, state.llbo);
+		Put(buf, state.svi_step);
+		Put(buf, state.num_accepted);
+		Put(buf, state.num_rejected);
+		Put(buf, state.num_plain);
+		Put(buf, static_cast<uint64_t>(state.rng_state.size()));
+		buf.insert(buf.end(), state.rng_state.begin(), state.rng_state.end());
+		PutTensor(buf, fit.p.freqs);
+		PutTensor(buf, fit.q.props);
+		PutTensor(buf, state.q_prev);
+	}
+
+	std::string path;
+	int every_iters;
+	double every_seconds;
+	int last_save_iters;
+	std::chrono::steady_clock::time_point last_save;
+	BackgroundFileWriter writer;
+};
+
+/// Continues the fit from its checkpoint if the run resumes and a matching one exists.
+/// Returns true if P, Q and `state' were loaded.
+static bool ResumeFit(Checkpointer* ckpt, const VBOptions& opts, bool is_verbose, VBFit& fit, VBState& state)
+{
+	if (ckpt == nullptr || !opts.is_resuming)
+		return false;
+	if (!IsFileExist(ckpt->GetPath())) {
+		if (is_verbose)
+			logger << Time << " No checkpoint `" << ckpt->GetPath() << "', starting from the beginning." << std::endl;
+		return false;
+	}
+	if (!ckpt->Load(fit, state)) {
+		logger << Time << ' ' << warning << " Checkpoint `" << ckpt->GetPath() << "' does not match this run, starting from the beginning!" << std::endl;
+		return false;
+	}
+	if (is_verbose)
+		logger << Time << " Resuming from `" << ckpt->GetPath() << "' at #" << state.num_iters << " iteration"
+			<< (state.is_converged ? ", the fit has already converged." : ".") << std::endl;
+	return true;
+}
+
+/// Writes a checkpoint in the background if one is due.
+inline static void UpdateCheckpoint(Checkpointer* ckpt, bool is_verbose, const VBFit& fit, const VBState& state)
+{
+	if (ckpt == nullptr || !ckpt->IsDue(state.num_iters))
+		return;
+	if (ckpt->Save(fit, state, false) && is_verbose)
+		logger << Time << " Checkpoint at #" << state.num_iters << " iteration -> " << ckpt->GetPath() << std::endl;
+}
+
+/// Writes the checkpoint of the last iteration and waits until it is on the disk.
+static void SaveLastCheckpoint(Checkpointer* ckpt, const VBFit& fit, const VBState& state)
+{
+	if (ckpt != nullptr && !(ckpt->Wait() && ckpt->Save(fit, state, true)))
+		logger << Time << ' ' << warning << " Could not write checkpoint `" << ckpt->GetPath() << "'!" << std::endl;
+}
+
+inline static void SetResult(const VBState& state, VBResult& res)
+{
+	res.num_iters = state.num_iters;
+	res.is_converged = state.is_converged;
+	res.llbo = state.llbo;
+}
+
+/// Phases of an iteration that --timings reports. A streamed Z is computed inside the Q and P updates,
+/// so only the stored Z has a phase of its own.
+enum VBPhase
+{
+	PHASE_Z,
+	PHASE_Q,
+	PHASE_P,
+	PHASE_EXPS,				// Expectations of P and Q.
+	PHASE_LLBO,
+	PHASE_CHECKPOINT,
+	NUM_PHASES,
+};
+
+static constexpr const char* PHASE_NAMES[NUM_PHASES] = { "z", "q", "p", "exps", "llbo", "checkpoint" };
+
+/// Resident set size of the process in MB, -1 where it is not known.
+static double GetResidentMB()
+{
+#if defined __linux__
+	std::ifstream statm("/proc/self/statm");
+	long long num_pages = 0, num_resident = 0;
+	if (statm >> num_pages >> num_resident)
+		return num_resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1 << 20);
 #endif
+	return -1;
+}
+
+/// JSON-lines stream of --timings, shared by the fits of a run. A line is written and flushed at once,
+/// so the stream can be followed while the fits run.
+class TimingsFile
+{
+public:
+	inline bool Open(const std::string& path)
+	{
+		file.open(path);
+		return file.is_open();
+	}
+
+	inline void WriteLine(const std::string& line)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		file << line << std::endl;
+	}
+
+private:
+	std::ofstream file;
+	std::mutex mtx;
+};
+
+/// Phase times of one fit, a JSON object per iteration, or per SQUAREM cycle of "iters" iterations:
+///   {"K":2,"restart":0,"iter":7,"iters":1,"ms":12.5,"phase_ms":{"z":0,"q":4.1,"p":6.2,...},
+///    "nlk_per_s":1.6e+09,"llbo":-2.4e+06,"llbo_delta":35.1,"rss_mb":812}
+/// nlk_per_s is N L K times the iterations per second. llbo and llbo_delta are null in iterations
+/// without an LLBO evaluation, llbo_delta also at the first one, rss_mb where it is not known.
+class IterTimings
+{
+public:
+	IterTimings(TimingsFile& file, int num_clusters, int restart, double num_genos)
+		: file(file), num_clusters(num_clusters), restart(restart), num_elems(num_genos * num_clusters)
+		, first_iter(0), has_llbo(false), last_llbo(0)
+	{
+		std::fill(phase_seconds, phase_seconds + NUM_PHASES, 0.0);
+	}
+
+	inline void Start(int first_iter)
+	{
+		this->first_iter = first_iter;
+		std::fill(phase_seconds, phase_seconds + NUM_PHASES, 0.0);
+		start = std::chrono::steady_clock::now();
+	}
+
+	inline void Add(VBPhase phase, double seconds) { phase_seconds[phase] += seconds; }
+
+	/// Writes the line of the iterations since Start, up to `num_iters', with `llbo' if `is_llbo_new'.
+	void End(int num_iters, bool is_llbo_new, double llbo)
+	{
+		const double SECONDS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const bool IS_LLBO_KNOWN = is_llbo_new && std::isfinite(llbo);
+		char buf[128];
+		std::string line(buf, snprintf(buf, sizeof(buf), "{\"K\":%d,\"restart\":%d,\"iter\":%d,\"iters\":%d,\"ms\":%.6g,\"phase_ms\":{",
+			num_clusters, restart, first_iter, num_iters - first_iter, SECONDS * 1e3));
+		for (int i = 0; i < NUM_PHASES; ++i)
+			line.append(buf, snprintf(buf, sizeof(buf), "%s\"%s\":%.6g", i ? "," : "", PHASE_NAMES[i], phase_seconds[i] * 1e3));
+		line.append(buf, snprintf(buf, sizeof(buf), "},\"nlk_per_s\":%.6g", SECONDS > 0 ? num_elems * (num_iters - first_iter) / SECONDS : 0.0));
+		AppendNumber(line, "llbo", llbo, "%.17g", IS_LLBO_KNOWN);
+		AppendNumber(line, "llbo_delta", llbo - last_llbo, "%.6g", IS_LLBO_KNOWN && has_llbo);
+		const double RSS_MB = GetResidentMB();
+		AppendNumber(line, "rss_mb", RSS_MB, "%.1f", RSS_MB >= 0);
+		line += '}';
+		file.WriteLine(line);
+
+		if (IS_LLBO_KNOWN) {
+			has_llbo = true;
+			last_llbo = llbo;
+		}
 	}
 
-	DumpVarParams(genos, z, q, p);		// Dump variational parameters.
-	CalcAcc(q);							// Report accuracy of clustering.
+private:
+	static inline void AppendNumber(std::string& line, const char* key, double val, const char* format, bool is_known)
+	{
+		line += ",\"";
+		line += key;
+		line += "\":";
+		if (!is_known) {
+			line += "null";
+			return;
+		}
+		char buf[32];
+		line.append(buf, snprintf(buf, sizeof(buf), format, val));
+	}
+
+	TimingsFile& file;
+	int num_clusters;
+	int restart;
+	double num_elems;		// N L K of an iteration.
+	int first_iter;
+	bool has_llbo;
+	double last_llbo;
+	double phase_seconds[NUM_PHASES];
+	std::chrono::steady_clock::time_point start;
+};
+
+/// Adds the time until the end of its scope to a phase of `timings', nothing if `timings' is null.
+/// With DISABLE_PHASE_TIMERS it is empty and does not even read the clock.
+class PhaseTimer
+{
+public:
+#ifndef DISABLE_PHASE_TIMERS
+	inline PhaseTimer(IterTimings* timings, VBPhase phase) : timings(timings), phase(phase)
+	{
+		if (timings != nullptr)
+			start = std::chrono::steady_clock::now();
+	}
+
+	inline ~PhaseTimer()
+	{
+		if (timings != nullptr)
+			timings->Add(phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+private:
+	IterTimings* timings;
+	VBPhase phase;
+	std::chrono::steady_clock::time_point start;
+#else
+	inline PhaseTimer(IterTimings*, VBPhase) {}
+#endif
+};
+
+/// Sum of (x_1 - x_0)^2 over every element; the zero padding adds nothing.
+static double GetSquaredDiff(const ParamsTensor& x_0, const ParamsTensor& x_1)
+{
+	double sm = 0.0;
+	for (size_t i = 0; i < x_0.GetSize(); ++i) {
+		const double D = static_cast<double>(x_1.GetData()[i]) - x_0.GetData()[i];
+		sm += D * D;
+	}
+	return sm;
+}
+
+/// Sum of (x_2 - 2 x_1 + x_0)^2 over every element.
+static double GetSquaredSecondDiff(const ParamsTensor& x_0, const ParamsTensor& x_1, const ParamsTensor& x_2)
+{
+	double sm = 0.0;
+	for (size_t i = 0; i < x_0.GetSize(); ++i) {
+		const double D = static_cast<double>(x_2.GetData()[i]) - 2.0 * x_1.GetData()[i] + x_0.GetData()[i];
+		sm += D * D;
+	}
+	return sm;
+}
+
+/// out = x_0 - 2 alpha (x_1 - x_0) + alpha^2 (x_2 - 2 x_1 + x_0).
+/// Returns false if an element is not positive, then `out' is not a valid Beta or Dirichlet parameter.
+static bool Extrapolate(const ParamsTensor& x_0, const ParamsTensor& x_1, const ParamsTensor& x_2, double alpha,
+		ParamsTensor& out)
+{
+	const size_t ROW_STRIDE = x_0.GetRowStride();
+	const size_t ROW_ELEMS = static_cast<size_t>(x_0.GetDim(x_0.GetNumDims() - 1));
+	bool is_valid = true;
+	for (size_t row = 0; row < x_0.GetSize(); row += ROW_STRIDE)
+		for (size_t i = row; i < row + ROW_ELEMS; ++i) {
+			const double X_0 = x_0.GetData()[i];
+			const double R = x_1.GetData()[i] - X_0;
+			const double V = x_2.GetData()[i] - 2.0 * x_1.GetData()[i] + X_0;
+			const double X = X_0 - 2.0 * alpha * R + alpha * alpha * V;
+			out.GetData()[i] = static_cast<FloatType>(X);
+			is_valid = is_valid && out.GetData()[i] > 0;
+		}
+	return is_valid;
+}
+
+/// SQUAREM (Varadhan and Roland 2008, step length S3) over the streamed (P, Q) -> (P, Q) iteration.
+/// A cycle makes two plain steps theta_1, theta_2 from theta_0, jumps to the extrapolated point and
+/// makes one more plain step from it to stabilize. If no jump is a valid parameter or the LLBO ends
+/// below the one of theta_0, the cycle keeps theta_2 instead.
+/// Checkpoints are taken between cycles.
+static void RunSquarem(const BitGenosMatrix& genos, const VBOptions& opts, ThreadPool& pool, bool is_verbose, VBFit& fit,
+		VBState& state, Checkpointer* ckpt, IterTimings* timings)
+{
+	P& p = fit.p;
+	Q& q = fit.q;
+	Expectations& exps = fit.exps;
+
+	auto UpdateExps = [&]() {
+		PhaseTimer timer(timings, PHASE_EXPS);
+		exps.UpdateQ(q, pool);
+		exps.UpdateP(p, pool);
+	};
+	auto Step = [&]() {
+		const StreamedZ STREAMED_Z(genos, exps);
+		{
+			PhaseTimer timer(timings, PHASE_Q);
+			q.Update(STREAMED_Z, pool);			// Update Q
+		}
+		{
+			PhaseTimer timer(timings, PHASE_P);
+			p.Update(genos, STREAMED_Z, pool);	// Update P
+		}
+		UpdateExps();
+		++state.num_iters;
+	};
+	auto CalcLLBO = [&]() {
+		PhaseTimer timer(timings, PHASE_LLBO);
+		return CalculateLLBO(genos, StreamedZ(genos, exps), q, p, exps, pool);
+	};
+
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	double old_LLBO = state.is_llbo_current ? state.llbo : CalcLLBO();
+	P p_0, p_1, p_2;
+	Q q_0, q_1, q_2;
+	while (state.num_iters < opts.max_iters && !state.is_converged) {
+		if (is_verbose)
+			LogIterations(state.num_iters, opts.max_iters, old_LLBO, true);
+
+		const int FIRST_ITER = state.num_iters;
+		if (timings != nullptr)
+			timings->Start(FIRST_ITER);
+		p_0 = p; q_0 = q;
+		Step();
+		p_1 = p; q_1 = q;
+		Step();
+
+		// alpha = -|r| / |v|,    r = theta_1 - theta_0,    v = theta_2 - 2 theta_1 + theta_0
+		const double RR = GetSquaredDiff(p_0.freqs, p_1.freqs) + GetSquaredDiff(q_0.props, q_1.props);
+		const double VV = GetSquaredSecondDiff(p_0.freqs, p_1.freqs, p.freqs) + GetSquaredSecondDiff(q_0.props, q_1.props, q.props);
+		double alpha = VV > 0 ? -std::sqrt(RR / VV) : -1.0;
+
+		// alpha = -1 is theta_2 itself, anything below it is a longer jump. A jump out of the
+		// parameter space is pulled back towards theta_2 by halving alpha + 1.
+		p_2 = p; q_2 = q;
+		bool is_jump = false;
+		for (int t = 0; t < SQUAREM_BACKTRACKS && alpha < -1.0; ++t, alpha = (alpha - 1.0) / 2.0)
+			if (Extrapolate(p_0.freqs, p_1.freqs, p_2.freqs, alpha, p.freqs)
+					&& Extrapolate(q_0.props, q_1.props, q_2.props, alpha, q.props)) {
+				is_jump = true;
+				break;
+			}
+
+		double new_LLBO = 0;
+		if (is_jump) {
+			UpdateExps();
+			Step();
+			new_LLBO = CalcLLBO();
+			if (new_LLBO >= old_LLBO)
+				++state.num_accepted;
+			else {
+				++state.num_rejected;
+				is_jump = false;
+			}
+		} else
+			++state.num_plain;
+
+		if (!is_jump) {
+			p = p_2; q = q_2;
+			UpdateExps();
+			new_LLBO = CalcLLBO();
+		}
+
+		const int NUM_CYCLE_ITERS = state.num_iters - FIRST_ITER;
+		const bool IS_CONVERGED = IsConverged(new_LLBO, old_LLBO, NUM_GENOS * NUM_CYCLE_ITERS, opts.epsilon)
+			&& state.num_iters >= opts.min_iters;
+		if (IS_CONVERGED && is_verbose)
+			logger << Time << " Converged at #" << state.num_iters - 1 << " iteration!         "
+				<< "new LLBO:" << new_LLBO << "     old LLBO:" << old_LLBO << std::endl;
+		old_LLBO = new_LLBO;
+		state.llbo = new_LLBO;
+		state.is_llbo_current = true;
+		if (IS_CONVERGED)
+			state.is_converged = true;
+		else {
+			PhaseTimer timer(timings, PHASE_CHECKPOINT);
+			UpdateCheckpoint(ckpt, is_verbose, fit, state);
+		}
+		if (timings != nullptr)
+			timings->End(state.num_iters, true, new_LLBO);
+	}
+	state.llbo = old_LLBO;
+	state.is_llbo_current = true;
+	SaveLastCheckpoint(ckpt, fit, state);
+
+	if (is_verbose)
+		logger << Time << " SQUAREM jumps accepted:" << state.num_accepted << "     rejected:" << state.num_rejected
+			<< "     plain cycles:" << state.num_plain << std::endl;
+}
+
+inline static std::string GetRngState(const std::mt19937_64& rng)
+{
+	std::ostringstream rng_stream;
+	rng_stream << rng;
+	return rng_stream.str();
+}
+
+/// Stochastic variational inference (Hoffman et al. 2013) with minibatches of individuals.
+/// Every step fits the local Q and Z of a minibatch to the current P, then moves P along the natural
+/// gradient of the minibatch scaled to the whole cohort. An iteration is one pass over a fresh shuffle
+/// of the individuals. The LLBO needs the Q of every individual, so a check first refreshes all of them.
+/// Checkpoints are taken between passes and keep the state of the shuffle generator.
+static void RunSvi(const BitGenosMatrix& genos, const VBOptions& opts, ThreadPool& pool, bool is_verbose, VBFit& fit,
+		VBState& state, Checkpointer* ckpt, IterTimings* timings)
+{
+	P& p = fit.p;
+	Q& q = fit.q;
+	Expectations& exps = fit.exps;
+
+	auto RefreshQ = [&]() {
+		for (int i = 0; i < SVI_LOCAL_ITERS; ++i) {
+			q.Update(StreamedZ(genos, exps), pool);
+			exps.UpdateQ(q, pool);
+		}
+	};
+	auto CalcLLBO = [&]() {
+		PhaseTimer timer(timings, PHASE_LLBO);
+		return CalculateLLBO(genos, StreamedZ(genos, exps), q, p, exps, pool);
+	};
+
+	const int BATCH_SIZE = std::min(opts.svi_batch, genos.GetNumIndivs());
+	const bool HAS_LLBO = opts.llbo_every > 0;
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	if (state.num_iters == 0 && HAS_LLBO) {
+		state.llbo = CalcLLBO();
+		state.is_llbo_current = true;
+	}
+	double old_LLBO = state.llbo;
+
+	std::mt19937_64 rng(fit.result.seed);
+	if (!state.rng_state.empty()) {
+		std::istringstream rng_stream(state.rng_state);
+		rng_stream >> rng;
+	}
+	std::vector<int> order(genos.GetNumIndivs()), batch;
+	long long& step = state.svi_step;
+	for (int itr = state.num_iters; itr < opts.max_iters && !state.is_converged; ++itr) {
+		if (is_verbose)
+			LogIterations(itr, opts.max_iters, old_LLBO, HAS_LLBO);
+		if (timings != nullptr)
+			timings->Start(itr);
+
+		// Every pass shuffles the identity, so the order only depends on the generator state.
+		for (int n = 0; n < genos.GetNumIndivs(); ++n)
+			order[n] = n;
+		std::shuffle(order.begin(), order.end(), rng);
+		for (int first = 0; first < genos.GetNumIndivs(); first += BATCH_SIZE, ++step) {
+			batch.assign(order.begin() + first, order.begin() + std::min(genos.GetNumIndivs(), first + BATCH_SIZE));
+
+			// Local step: Q and Z of the minibatch against the current P.
+			{
+				PhaseTimer timer(timings, PHASE_Q);
+				pool.ParallelFor(0, static_cast<int>(batch.size()), [&](int first_idx, int last_idx) {
+					for (int i = first_idx; i < last_idx; ++i)
+						for (int j = 0; j < SVI_LOCAL_ITERS; ++j) {
+							q.Update(StreamedZ(genos, exps), batch[i], batch[i] + 1);
+							exps.UpdateQ(q, batch[i], batch[i] + 1);
+						}
+				});
+			}
+
+			// Global step on P.
+			const double RHO = std::pow(opts.svi_tau + step, -opts.svi_kappa);
+			{
+				PhaseTimer timer(timings, PHASE_P);
+				p.UpdateStochastic(genos, StreamedZ(genos, exps), batch, RHO, pool);
+			}
+			PhaseTimer timer(timings, PHASE_EXPS);
+			exps.UpdateP(p, pool);
+		}
+		state.num_iters = itr + 1;
+		state.is_llbo_current = false;
+
+		bool is_llbo_new = false;
+		if (HAS_LLBO && (itr + 1) % opts.llbo_every == 0) {
+			{
+				PhaseTimer timer(timings, PHASE_LLBO);
+				RefreshQ();
+			}
+			const double NEW_LLBO = CalcLLBO();
+			state.is_llbo_current = true;
+			state.llbo = NEW_LLBO;
+			is_llbo_new = true;
+			if (IsConverged(NEW_LLBO, old_LLBO, NUM_GENOS * opts.llbo_every, opts.epsilon) && itr + 1 >= opts.min_iters) {
+				if (is_verbose)
+					logger << Time << " Converged at #" << itr << " iteration!         "
+						<< "new LLBO:" << NEW_LLBO << "     old LLBO:" << old_LLBO << std::endl;
+				state.is_converged = true;
+			} else
+				old_LLBO = NEW_LLBO;
+		}
+
+		if (!state.is_converged && ckpt != nullptr && ckpt->IsDue(state.num_iters)) {
+			PhaseTimer timer(timings, PHASE_CHECKPOINT);
+			state.rng_state = GetRngState(rng);
+			UpdateCheckpoint(ckpt, is_verbose, fit, state);
+		}
+		if (timings != nullptr)
+			timings->End(state.num_iters, is_llbo_new, state.llbo);
+	}
+
+	// Refreshing Q for the last LLBO is not a step of the iterations, so a resumed fit goes on from before it.
+	state.rng_state = GetRngState(rng);
+	SaveLastCheckpoint(ckpt, fit, state);
+
+	if (!state.is_llbo_current) {
+		RefreshQ();
+		state.llbo = CalcLLBO();
+		state.is_llbo_current = true;
+	}
+
+	if (is_verbose)
+		logger << Time << " SVI steps:" << step << "     batch:" << BATCH_SIZE << std::endl;
+}
+
+/// Runs `step' until opts.max_iters iterations or until the LLBO, evaluated every opts.llbo_every
+/// iterations by `calc_llbo', converges. Starts from the iteration of `state' and keeps it up to date.
+/// The phases of `step' are timed by the step itself, the LLBO and checkpoints here.
+static void Iterate(const VBOptions& opts, double num_genos, bool is_verbose, const std::function<void()>& step,
+		const std::function<double()>& calc_llbo, VBFit& fit, VBState& state, Checkpointer* ckpt, IterTimings* timings)
+{
+	const bool HAS_LLBO = opts.llbo_every > 0;
+	if (state.num_iters == 0 && HAS_LLBO) {
+		state.llbo = calc_llbo();
+		state.is_llbo_current = true;
+	}
+	double old_LLBO = state.llbo;
+
+	for (int itr = state.num_iters; itr < opts.max_iters && !state.is_converged; ++itr) {
+		if (is_verbose)
+			LogIterations(itr, opts.max_iters, old_LLBO, HAS_LLBO);
+		if (timings != nullptr)
+			timings->Start(itr);
+
+		step();
+		state.num_iters = itr + 1;
+		state.is_llbo_current = false;
+
+		if (HAS_LLBO && (itr + 1) % opts.llbo_every == 0) {
+			double new_LLBO = 0;
+			{
+				PhaseTimer timer(timings, PHASE_LLBO);
+				new_LLBO = calc_llbo();
+			}
+			state.is_llbo_current = true;
+			state.llbo = new_LLBO;
+			if (IsConverged(new_LLBO, old_LLBO, num_genos * opts.llbo_every, opts.epsilon) && itr + 1 >= opts.min_iters) {
+				if (is_verbose)
+					logger << Time << " Converged at #" << itr << " iteration!         "
+						<< "new LLBO:" << new_LLBO << "     old LLBO:" << old_LLBO << std::endl;
+				state.is_converged = true;
+			} else
+				old_LLBO = new_LLBO;
+		}
+		if (!state.is_converged) {
+			PhaseTimer timer(timings, PHASE_CHECKPOINT);
+			UpdateCheckpoint(ckpt, is_verbose, fit, state);
+		}
+		if (timings != nullptr)
+			timings->End(state.num_iters, state.is_llbo_current, state.llbo);
+	}
+
+	if (!state.is_llbo_current) {
+		state.llbo = calc_llbo();
+		state.is_llbo_current = true;
+	}
+	SaveLastCheckpoint(ckpt, fit, state);
+}
+
+/// Fits `num_clusters' populations to the genotypes starting from the initialization of `seed'.
+/// All the work runs on `pool' and the genotypes are only read, so several fits can share one matrix.
+/// Progress is logged only if `is_verbose' is true.
+static void RunVB(const BitGenosMatrix& genos, int num_clusters, uint64_t seed, const VBOptions& opts, ThreadPool& pool,
+		bool is_verbose, VBFit& fit, Checkpointer* ckpt, IterTimings* timings)
+{
+	const auto START = std::chrono::steady_clock::now();
+	VBResult& res = fit.result;
+	res = VBResult();
+	res.num_clusters = num_clusters;
+	res.seed = seed;
+
+	// Initialize parameters.
+	if (is_verbose)
+		logger << Time << " Initialize P, Z, and Q . . ." << std::endl;
+	P& p = fit.p; p.Init(genos.GetNumLoci(), num_clusters);
+	Q& q = fit.q; q.Init(genos.GetNumIndivs(), num_clusters);
+	Expectations& exps = fit.exps; exps.Init(genos.GetNumIndivs(), genos.GetNumLoci(), num_clusters);
+	VBState state(GetVBMode(opts));
+	if (state.mode == VB_STORED)
+		state.q_prev = q.props;
+	const bool IS_RESUMED = ResumeFit(ckpt, opts, is_verbose, fit, state);
+
+	Z z;
+	if (opts.is_streaming) {
+		// Start from the P that the first update of random stored assignments would give.
+		if (!IS_RESUMED)
+			p.Update(genos, RandomZ(genos.GetNumIndivs(), genos.GetNumLoci(), num_clusters, seed), pool);
+	} else {
+		z.Init(genos.GetNumIndivs(), genos.GetNumLoci(), num_clusters, seed);
+		if (IS_RESUMED) {
+			// The stored Z of the checkpointed iteration came from its P and the Q before it.
+			std::swap(q.props, state.q_prev);
+			exps.UpdateP(p, pool);
+			exps.UpdateQ(q, pool);
+			z.Update(genos, exps, pool);
+			std::swap(q.props, state.q_prev);
+		}
+	}
+
+	exps.UpdateP(p, pool);
+	exps.UpdateQ(q, pool);
+
+	if (is_verbose)
+		logger << Time << " Start iterations . . ." << std::endl;
+
+	if (state.mode == VB_SVI || state.mode == VB_SQUAREM) {
+		if (state.mode == VB_SVI)
+			RunSvi(genos, opts, pool, is_verbose, fit, state, ckpt, timings);
+		else
+			RunSquarem(genos, opts, pool, is_verbose, fit, state, ckpt, timings);
+		SetResult(state, res);
+		res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - START).count();
+		return;
+	}
+
+	auto CalcLLBO = [&]() {
+		return opts.is_streaming ?
+			CalculateLLBO(genos, StreamedZ(genos, exps), q, p, exps, pool) :
+			CalculateLLBO(genos, z, q, p, exps, pool);
+	};
+	auto Step = [&]() {
+		if (opts.is_streaming) {
+			// Q and the next P both come from the same on-the-fly Z, so one streamed
+			// iteration is the Z, Q and following P updates of the stored path.
+			const StreamedZ STREAMED_Z(genos, exps);
+			{
+				PhaseTimer timer(timings, PHASE_Q);
+				q.Update(STREAMED_Z, pool);			// Update Q
+			}
+			{
+				PhaseTimer timer(timings, PHASE_P);
+				p.Update(genos, STREAMED_Z, pool);	// Update P
+			}
+			PhaseTimer timer(timings, PHASE_EXPS);
+			exps.UpdateQ(q, pool);
+			exps.UpdateP(p, pool);
+		} else {
+			{
+				PhaseTimer timer(timings, PHASE_P);
+				p.Update(genos, z, pool);			// Update P
+			}
+			{
+				PhaseTimer timer(timings, PHASE_EXPS);
+				exps.UpdateP(p, pool);
+			}
+			{
+				PhaseTimer timer(timings, PHASE_Z);
+				z.Update(genos, exps, pool);		// Update Z
+			}
+			if (ckpt != nullptr)
+				state.q_prev = q.props;
+			{
+				PhaseTimer timer(timings, PHASE_Q);
+				q.Update(z, pool);					// Update Q
+			}
+			PhaseTimer timer(timings, PHASE_EXPS);
+			exps.UpdateQ(q, pool);
+		}
+	};
+
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	Iterate(opts, NUM_GENOS, is_verbose, Step, CalcLLBO, fit, state, ckpt, timings);
+	SetResult(state, res);
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - START).count();
+}
+
+/// Calls func(first_locus, last_locus) on consecutive blocks of opts.block_loci loci of a mapped genotype file.
+/// The next block is prefetched before func runs on the current one and a finished block is released,
+/// so about two blocks of genotypes are resident at any time. Blocks are not released while other jobs read
+/// the same mapping (opts.is_shared_genos), as they would evict the pages those jobs are about to read.
+template <typename Func>
+static void ForEachLocusBlock(const MappedGenosMatrix& genos, const VBOptions& opts, const Func& func)
+{
+	const int NUM_LOCI = genos.GetNumLoci();
+	genos.Prefetch(0, std::min(NUM_LOCI, opts.block_loci));
+	for (int first_locus = 0; first_locus < NUM_LOCI; first_locus += opts.block_loci) {
+		const int LAST_LOCUS = std::min(NUM_LOCI, first_locus + opts.block_loci);
+		genos.Prefetch(LAST_LOCUS, std::min(NUM_LOCI, LAST_LOCUS + opts.block_loci));
+		func(first_locus, LAST_LOCUS);
+		if (!opts.is_shared_genos)
+			genos.Release(first_locus, LAST_LOCUS);
+	}
+}
+
+/// Genotypes in memory are a single block.
+template <typename Func>
+static void ForEachLocusBlock(const BitGenosMatrix& genos, const VBOptions& opts, const Func& func)
+{
+	(void) opts;
+	func(0, genos.GetNumLoci());
+}
+
+/// A cross-validation fold goes through the blocks of the genotypes it holds out from.
+template <typename Genos, typename Func>
+static void ForEachLocusBlock(const HeldOutGenos<Genos>& genos, const VBOptions& opts, const Func& func)
+{
+	ForEachLocusBlock(genos.genos, opts, func);
+}
+
+/// LLBO of the current P and Q with the streamed Z.
+static double CalcStreamedLLBO(const BitGenosMatrix& genos, const P& p, const Q& q, const Expectations& exps,
+		const VBOptions& opts, ThreadPool& pool)
+{
+	(void) opts;
+	return CalculateLLBO(genos, StreamedZ(genos, exps), q, p, exps, pool);
+}
+
+template <typename Genos>
+static double CalcStreamedLLBO(const Genos& genos, const P& p, const Q& q, const Expectations& exps,
+		const VBOptions& opts, ThreadPool& pool)
+{
+	const StreamedZ STREAMED_Z(genos, exps);
+	double LLBO = 0.0;
+	ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+		LLBO += pool.ParallelSum(first_locus, last_locus, LLBO_BLOCK_LOCI, [&](int first_l, int last_l) {
+			return CalculateLLBO(genos, STREAMED_Z, p, exps, first_l, last_l);
+		});
+	});
+	return LLBO + CalculateLLBO(q, exps);
+}
+
+/// Q from the streamed Z of the current expectations.
+static void UpdateStreamedQ(const BitGenosMatrix& genos, const Expectations& exps, const VBOptions& opts, ThreadPool& pool,
+		Q& q)
+{
+	(void) opts;
+	q.Update(StreamedZ(genos, exps), pool);
+}
+
+static void UpdateStreamedQ(const MappedGenosMatrix& genos, const Expectations& exps, const VBOptions& opts, ThreadPool& pool,
+		Q& q)
+{
+	const StreamedZ STREAMED_Z(genos, exps);
+	std::vector<AccumType> sm_z_ab(static_cast<size_t>(genos.GetNumIndivs()) * q.GetNumClusters());
+	ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+		pool.ParallelFor(0, genos.GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+			q.AddSums(STREAMED_Z, first_locus, last_locus, first_indiv, last_indiv, sm_z_ab.data());
+		});
+	});
+	q.SetFromSums(sm_z_ab.data());
+}
+
+/// Out-of-core streamed VB over a memory-mapped genotype file, otherwise the same as the streamed RunVB.
+/// An iteration reads the file once, block by block. The P of a locus only needs the genotypes of the
+/// locus, so it is finished with its block; the Q sums of every individual accumulate over the blocks
+/// and give the new Q after the last one. Besides the mapped blocks only P, Q, their expectations and
+/// the N x K sums are kept, never the N x L genotype matrix.
+/// Genos is MappedGenosMatrix or the HeldOutGenos of a cross-validation fold, in memory or mapped.
+template <typename Genos>
+static void RunVB(const Genos& genos, int num_clusters, uint64_t seed, const VBOptions& opts, ThreadPool& pool,
+		bool is_verbose, VBFit& fit, Checkpointer* ckpt, IterTimings* timings)
+{
+	const auto START = std::chrono::steady_clock::now();
+	VBResult& res = fit.result;
+	res = VBResult();
+	res.num_clusters = num_clusters;
+	res.seed = seed;
+
+	// Initialize parameters.
+	if (is_verbose)
+		logger << Time << " Initialize P and Q . . ." << std::endl;
+	P& p = fit.p; p.Init(genos.GetNumLoci(), num_clusters);
+	Q& q = fit.q; q.Init(genos.GetNumIndivs(), num_clusters);
+
+	// Start from the P that the first update of random stored assignments would give.
+	VBState state(VB_STREAMED);
+	if (!ResumeFit(ckpt, opts, is_verbose, fit, state)) {
+		const RandomZ RANDOM_Z(genos.GetNumIndivs(), genos.GetNumLoci(), num_clusters, seed);
+		ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+			pool.ParallelFor(first_locus, last_locus, [&](int first_l, int last_l) {
+				p.UpdateFromGenos(genos, RANDOM_Z, first_l, last_l);
+			});
+		});
+	}
+
+	Expectations& exps = fit.exps; exps.Init(genos.GetNumIndivs(), genos.GetNumLoci(), num_clusters);
+	exps.UpdateP(p, pool);
+	exps.UpdateQ(q, pool);
+
+	if (is_verbose)
+		logger << Time << " Start iterations . . ." << std::endl;
+
+	auto CalcLLBO = [&]() {
+		return CalcStreamedLLBO(genos, p, q, exps, opts, pool);
+	};
+
+	std::vector<AccumType> sm_z_ab;
+	auto Step = [&]() {
+		const StreamedZ STREAMED_Z(genos, exps);
+		sm_z_ab.assign(static_cast<size_t>(genos.GetNumIndivs()) * num_clusters, AccumType());
+		ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+			{
+				PhaseTimer timer(timings, PHASE_Q);
+				pool.ParallelFor(0, genos.GetNumIndivs(), [&](int first_indiv, int last_indiv) {
+					q.AddSums(STREAMED_Z, first_locus, last_locus, first_indiv, last_indiv, sm_z_ab.data());
+				});
+			}
+			PhaseTimer timer(timings, PHASE_P);
+			pool.ParallelFor(first_locus, last_locus, [&](int first_l, int last_l) {
+				p.UpdateFromGenos(genos, STREAMED_Z, first_l, last_l);
+			});
+		});
+		{
+			PhaseTimer timer(timings, PHASE_Q);
+			q.SetFromSums(sm_z_ab.data());
+		}
+		PhaseTimer timer(timings, PHASE_EXPS);
+		exps.UpdateQ(q, pool);
+		exps.UpdateP(p, pool);
+	};
+
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	Iterate(opts, NUM_GENOS, is_verbose, Step, CalcLLBO, fit, state, ckpt, timings);
+	SetResult(state, res);
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - START).count();
+}
+
+/// Log probability of the genotypes of every individual under every cluster, N x K.
+static void CalcLogProbs(const BitGenosMatrix& genos, const Expectations& exps, const VBOptions& opts,
+		ThreadPool& pool, std::vector<double>& log_probs)
+{
+	(void) opts;
+	log_probs.assign(static_cast<size_t>(genos.GetNumIndivs()) * exps.GetNumClusters(), 0.0);
+	AddLogProbs(genos, exps, 0, genos.GetNumLoci(), log_probs, pool);
+}
+
+static void CalcLogProbs(const MappedGenosMatrix& genos, const Expectations& exps, const VBOptions& opts,
+		ThreadPool& pool, std::vector<double>& log_probs)
+{
+	log_probs.assign(static_cast<size_t>(genos.GetNumIndivs()) * exps.GetNumClusters(), 0.0);
+	ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+		AddLogProbs(genos, exps, first_locus, last_locus, log_probs, pool);
+	});
+}
+
+/// Dumps Q and the log probabilities to `path' + ".txt", or ".bin" with --binary-props.
+static bool DumpProps(const std::string& path, const Q& q, const std::vector<double>& log_probs,
+		const VBOptions& opts, ThreadPool& pool)
+{
+	const std::string PATH = path + (opts.is_binary_props ? ".bin" : ".txt");
+	const bool IS_OK = opts.is_binary_props ? DumpBinaryProps(PATH, q, log_probs) : DumpVarParams(PATH, q, log_probs, pool);
+	if (!IS_OK)
+		logger << Time << ' ' << warning << " Could not write `" << PATH << "' for dumping variational parameters!" << std::endl;
+	return IS_OK;
+}
+
+/// Runs jobs 0 .. num_jobs - 1 on min(num_jobs, num_threads) groups of threads.
+/// Every group owns a pool and takes the next job until all of them are done.
+static void RunJobs(int num_jobs, int num_threads, const std::function<void(int, ThreadPool&)>& job)
+{
+	const int NUM_GROUPS = std::max(1, std::min(num_jobs, num_threads));
+	std::atomic<int> next_job(0);
+	auto RunGroup = [&](int group) {
+		ThreadPool pool(num_threads / NUM_GROUPS + (group < num_threads % NUM_GROUPS ? 1 : 0));
+		for (int j = next_job++; j < num_jobs; j = next_job++)
+			job(j, pool);
+	};
+
+	std::vector<std::thread> groups;
+	for (int g = 1; g < NUM_GROUPS; ++g)
+		groups.emplace_back(RunGroup, g);
+	RunGroup(0);
+	for (auto& g : groups)
+		g.join();
+}
+
+/// Options of the jobs of RunJobs. Jobs of concurrent groups read the same genotypes.
+inline static VBOptions GetJobOptions(const VBOptions& opts, int num_jobs, int num_threads)
+{
+	VBOptions job_opts = opts;
+	job_opts.is_shared_genos = std::min(num_jobs, num_threads) > 1;
+	return job_opts;
+}
+
+template <typename Genos>
+static bool DumpSweep(const std::string& path, const Genos& genos, const std::vector<VBFit>& fits)
+{
+	std::ofstream sweep_file(path);
+	if (!sweep_file.is_open())
+		return false;
+
+	sweep_file.precision(std::numeric_limits<double>::digits10);
+	sweep_file << "K\tLLBO\tLLBO_PER_GENO\tITERS\tCONVERGED\tSECONDS\tRESTART\tSEED" << std::endl;
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	for (const VBFit& fit : fits) {
+		const VBResult& RES = fit.result;
+		sweep_file << RES.num_clusters << '\t' << RES.llbo << '\t' << RES.llbo / NUM_GENOS << '\t' << RES.num_iters << '\t'
+			<< RES.is_converged << '\t' << RES.seconds << '\t' << RES.restart << '\t' << RES.seed << std::endl;
+	}
+	return true;
+}
+
+/// Fits every K of the sweep, or the K of the genotype file, from opts.num_restarts initializations each.
+/// Restarts and Ks run concurrently, largest K first. Only the best LLBO of each K is kept and dumped.
+/// Genos is BitGenosMatrix or MappedGenosMatrix.
+template <typename Genos>
+static bool RunFits(const Genos& genos, const VBOptions& opts, int num_threads)
+{
+	const int MIN_K = opts.IsSweep() ? opts.min_clusters : genos.GetNumClusters();
+	const int MAX_K = opts.IsSweep() ? opts.max_clusters : genos.GetNumClusters();
+	const int NUM_KS = MAX_K - MIN_K + 1;
+	const int NUM_JOBS = NUM_KS * opts.num_restarts;
+	const bool IS_VERBOSE = NUM_JOBS == 1;
+
+	if (!IS_VERBOSE)
+		logger << Time << " Fitting K = " << MIN_K << " .. " << MAX_K << " with " << opts.num_restarts
+			<< " restarts each in " << std::min(NUM_JOBS, num_threads) << " groups . . ." << std::endl;
+
+	std::vector<VBFit> best_fits(NUM_KS);
+	std::vector<bool> has_fit(NUM_KS, false);
+	std::mutex mtx;
+	TimingsFile timings_file;
+	if (opts.is_timing && !timings_file.Open(TIMINGS_PATH)) {
+		logger << Time << ' ' << warning << " Could not open `" << TIMINGS_PATH << "' for the timings!" << std::endl;
+		return false;
+	}
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	const VBOptions JOB_OPTS = GetJobOptions(opts, NUM_JOBS, num_threads);
+	RunJobs(NUM_JOBS, num_threads, [&](int job, ThreadPool& pool) {
+		const int K = MAX_K - job / opts.num_restarts;
+		const int RESTART = job % opts.num_restarts;
+		VBFit fit;
+		std::unique_ptr<Checkpointer> ckpt;
+		if (opts.checkpoint_path != nullptr) {
+			const std::string SUFFIX = NUM_JOBS == 1 ? "" : ".K" + std::to_string(K) + ".R" + std::to_string(RESTART);
+			ckpt.reset(new Checkpointer(opts.checkpoint_path + SUFFIX, opts.checkpoint_every, opts.checkpoint_seconds));
+		}
+		std::unique_ptr<IterTimings> timings;
+		if (opts.is_timing)
+			timings.reset(new IterTimings(timings_file, K, RESTART, NUM_GENOS));
+		RunVB(genos, K, GetFitSeed(opts.seed, K, RESTART), JOB_OPTS, pool, IS_VERBOSE, fit, ckpt.get(), timings.get());
+		fit.result.restart = RESTART;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		const VBResult& RES = fit.result;
+		logger << Time << " K:" << K << "     restart:" << RESTART << "     LLBO:" << RES.llbo << "     iters:" << RES.num_iters
+				<< (RES.is_converged ? " (converged)" : "") << "     " << RES.seconds << " s" << std::endl;
+
+		// The earliest restart wins ties, so the result does not depend on the finishing order.
+		VBFit& best = best_fits[K - MIN_K];
+		if (!has_fit[K - MIN_K] || RES.llbo > best.result.llbo
+				|| (RES.llbo == best.result.llbo && RESTART < best.result.restart)) {
+			best = std::move(fit);
+			has_fit[K - MIN_K] = true;
+		}
+	});
+
+	logger << Time << " Dumping variational parameters . . ." << std::endl;
+	bool is_ok = true;
+	ThreadPool pool(num_threads);
+	std::vector<double> log_probs;
+	for (const VBFit& fit : best_fits) {
+		const int K = fit.result.num_clusters;
+		const std::string PATH = DUMP_PATH + (opts.IsSweep() ? "props_K" + std::to_string(K) : "props");
+		if (opts.num_restarts > 1)
+			logger << Time << " K:" << K << "     best restart:" << fit.result.restart << "     seed:" << fit.result.seed
+				<< "     LLBO:" << fit.result.llbo << std::endl;
+		CalcLogProbs(genos, fit.exps, opts, pool, log_probs);
+		if (!DumpProps(PATH, fit.q, log_probs, opts, pool))
+			is_ok = false;
+		const std::string P_PATH = DUMP_PATH + (opts.IsSweep() ? "p_K" + std::to_string(K) + ".bin" : "p.bin");
+		if (!DumpP(P_PATH, fit.p)) {
+			logger << Time << ' ' << warning << " Could not write `" << P_PATH << "'!" << std::endl;
+			is_ok = false;
+		}
+
+		// Report accuracy of clustering, the true labels are only known for the K of the genotype file.
+		if (K == genos.GetNumClusters())
+			CalcAcc(fit.q);
+	}
+
+	if (opts.IsSweep() && !DumpSweep(DUMP_PATH + "sweep.txt", genos, best_fits)) {
+		logger << Time << ' ' << warning << " Could not open output file for dumping the sweep!" << std::endl;
+		is_ok = false;
+	}
+	logger << Time << " Dumping is done!" << std::endl;
+	return is_ok;
+}
+
+
+/// Fits Q of the individuals in `genos' against the fixed P of an earlier fit on the same loci.
+/// Given P the individuals are independent, so an iteration is one parallel pass of Q and Z updates
+/// over the new genotypes only, O(N L K) for N new individuals, whatever the size of the first cohort.
+template <typename Genos>
+static bool RunProjection(const Genos& genos, const VBOptions& opts, int num_threads)
+{
+	const auto START = std::chrono::steady_clock::now();
+	VBFit fit;
+	P& p = fit.p;
+	if (!ReadP(opts.project_path, p)) {
+		logger << Time << ' ' << warning << " Could not read P from `" << opts.project_path << "'!" << std::endl;
+		return false;
+	}
+	if (p.GetNumLoci() != genos.GetNumLoci()) {
+		logger << Time << ' ' << warning << " P of `" << opts.project_path << "' has " << p.GetNumLoci()
+			<< " loci, the genotypes " << genos.GetNumLoci() << "!" << std::endl;
+		return false;
+	}
+
+	const int K = p.GetNumClusters();
+	logger << Time << " Projecting " << genos.GetNumIndivs() << " individuals on P of K = " << K << " . . ." << std::endl;
+	ThreadPool pool(num_threads);
+	Q& q = fit.q; q.Init(genos.GetNumIndivs(), K);
+	Expectations& exps = fit.exps; exps.Init(genos.GetNumIndivs(), genos.GetNumLoci(), K);
+	VBResult& res = fit.result;
+	res.num_clusters = K;
+	res.seed = opts.seed;
+
+	std::unique_ptr<Checkpointer> ckpt;
+	if (opts.checkpoint_path != nullptr)
+		ckpt.reset(new Checkpointer(opts.checkpoint_path, opts.checkpoint_every, opts.checkpoint_seconds));
+	VBState state(VB_PROJECTION);
+	ResumeFit(ckpt.get(), opts, true, fit, state);
+	exps.UpdateP(p, pool);
+	exps.UpdateQ(q, pool);
+
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	TimingsFile timings_file;
+	std::unique_ptr<IterTimings> timings;
+	if (opts.is_timing) {
+		if (!timings_file.Open(TIMINGS_PATH)) {
+			logger << Time << ' ' << warning << " Could not open `" << TIMINGS_PATH << "' for the timings!" << std::endl;
+			return false;
+		}
+		timings.reset(new IterTimings(timings_file, K, 0, NUM_GENOS));
+	}
+
+	auto Step = [&]() {
+		{
+			PhaseTimer timer(timings.get(), PHASE_Q);
+			UpdateStreamedQ(genos, exps, opts, pool, q);
+		}
+		PhaseTimer timer(timings.get(), PHASE_EXPS);
+		exps.UpdateQ(q, pool);
+	};
+	auto CalcLLBO = [&]() {
+		return CalcStreamedLLBO(genos, p, q, exps, opts, pool);
+	};
+
+	Iterate(opts, NUM_GENOS, true, Step, CalcLLBO, fit, state, ckpt.get(), timings.get());
+	SetResult(state, res);
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - START).count();
+	logger << Time << " K:" << K << "     LLBO:" << res.llbo << "     iters:" << res.num_iters
+		<< (res.is_converged ? " (converged)" : "") << "     " << res.seconds << " s" << std::endl;
+
+	logger << Time << " Dumping variational parameters . . ." << std::endl;
+	std::vector<double> log_probs;
+	CalcLogProbs(genos, exps, opts, pool, log_probs);
+	if (!DumpProps(DUMP_PATH + "props_projected", q, log_probs, opts, pool))
+		return false;
+	if (K == genos.GetNumClusters())
+		CalcAcc(q);
+	logger << Time << " Dumping is done!" << std::endl;
+	return true;
+}
+
+
+/// Seed of the held-out entries of cross-validation: the K = 0 slot of GetFitSeed, which no fit uses.
+inline static uint64_t GetMaskSeed(uint64_t seed)
+{
+	return GetFitSeed(seed, 0, 0);
+}
+
+/// Number of held-out entries of a fold that have a call, the entries its deviance is scored on.
+template <typename Genos>
+static int64_t CountHeldOut(const HeldOutGenos<Genos>& genos, const VBOptions& opts, ThreadPool& pool)
+{
+	double num_held_out = 0;
+	ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+		num_held_out += pool.ParallelSum(first_locus, last_locus, LLBO_BLOCK_LOCI, [&](int first_l, int last_l) {
+			double num = 0;
+			for (int l = first_l; l < last_l; ++l)
+				for (int n = 0; n < genos.GetNumIndivs(); ++n)
+					num += genos.IsHeldOut(n, l) && genos.genos.GetGeno(n, l) != BitGenosMatrix::MISSING_GENO;
+			return num;
+		});
+	});
+	return static_cast<int64_t>(num_held_out);
+}
+
+/// Held-out deviance of a fold, -2 sum log Pr(G_{nl} | q_n, p_l) over its held-out calls, with the posterior
+/// means of Q and P. G_{nl} is binomial in the admixed allele frequency sum_k q_{nk} p_{lk}.
+template <typename Genos>
+static double CalcHeldOutDeviance(const HeldOutGenos<Genos>& genos, const P& p, const Q& q, const VBOptions& opts,
+		ThreadPool& pool)
+{
+	const int K = q.GetNumClusters();
+	std::vector<double> mean_q(static_cast<size_t>(q.GetNumIndivs()) * K);
+	for (int n = 0; n < q.GetNumIndivs(); ++n) {
+		const double Q_0 = q.GetQ0(n);
+		for (int k = 0; k < K; ++k)
+			mean_q[static_cast<size_t>(n) * K + k] = q.GetAdmixProp(n, k) / Q_0;
+	}
+
+	const double LOG_2 = log(2);
+	double deviance = 0;
+	ForEachLocusBlock(genos, opts, [&](int first_locus, int last_locus) {
+		deviance += pool.ParallelSum(first_locus, last_locus, LLBO_BLOCK_LOCI, [&](int first_l, int last_l) {
+			std::vector<double> mean_p(K);
+			double log_lik = 0;
+			for (int l = first_l; l < last_l; ++l) {
+				for (int k = 0; k < K; ++k)
+					mean_p[k] = p.GetFreq(l, k, 0) / (static_cast<double>(p.GetFreq(l, k, 0)) + p.GetFreq(l, k, 1));
+				for (int n = 0; n < genos.GetNumIndivs(); ++n) {
+					if (!genos.IsHeldOut(n, l))
+						continue;
+					const int G = genos.genos.GetGeno(n, l);
+					if (G == BitGenosMatrix::MISSING_GENO)
+						continue;
+					const double* Q_N = &mean_q[static_cast<size_t>(n) * K];
+					double freq = 0;
+					for (int k = 0; k < K; ++k)
+						freq += Q_N[k] * mean_p[k];
+					log_lik += G == 0 ? 2 * log(1 - freq) : G == 1 ? LOG_2 + log(freq) + log(1 - freq) : 2 * log(freq);
+				}
+			}
+			return -2 * log_lik;
+		});
+	});
+	return deviance;
+}
+
+/// Fit of one K on one cross-validation fold, from the restart with the best LLBO on the calls it was fitted to.
+struct CVResult
+{
+	CVResult() : deviance(0) {}
+
+	VBResult result;
+	double deviance;		// Held-out deviance.
+};
+
+static bool DumpCrossValidation(const std::string& path, const std::vector<CVResult>& results,
+		const std::vector<int64_t>& num_held_out)
+{
+	std::ofstream cv_file(path);
+	if (!cv_file.is_open())
+		return false;
+
+	cv_file.precision(std::numeric_limits<double>::digits10);
+	cv_file << "K\tFOLD\tHELD_OUT\tDEVIANCE\tDEVIANCE_PER_GENO\tLLBO\tITERS\tCONVERGED\tSECONDS\tRESTART\tSEED" << std::endl;
+	const int NUM_FOLDS = static_cast<int>(num_held_out.size());
+	for (size_t i = 0; i < results.size(); ++i) {
+		const VBResult& RES = results[i].result;
+		const int FOLD = static_cast<int>(i % NUM_FOLDS);
+		cv_file << RES.num_clusters << '\t' << FOLD << '\t' << num_held_out[FOLD] << '\t' << results[i].deviance << '\t'
+			<< results[i].deviance / num_held_out[FOLD] << '\t' << RES.llbo << '\t' << RES.num_iters << '\t'
+			<< RES.is_converged << '\t' << RES.seconds << '\t' << RES.restart << '\t' << RES.seed << std::endl;
+	}
+	return true;
+}
+
+/// Chooses K by cross-validation. Every fold holds out opts.cv_fraction of the genotype entries and fits every
+/// K of the sweep, or the K of the genotype file, from opts.num_restarts initializations to the other calls;
+/// the restart with the best LLBO is scored by the deviance of the held-out calls. Folds only mask the shared
+/// genotypes, so all (K, fold, restart) fits run concurrently, largest K first, on one matrix.
+/// The Ks are logged ranked by the mean deviance per held-out call over the folds and every fit goes to cv.txt.
+template <typename Genos>
+static bool RunCrossValidation(const Genos& genos, const VBOptions& opts, int num_threads)
+{
+	const int MIN_K = opts.IsSweep() ? opts.min_clusters : genos.GetNumClusters();
+	const int MAX_K = opts.IsSweep() ? opts.max_clusters : genos.GetNumClusters();
+	const int NUM_KS = MAX_K - MIN_K + 1;
+	const int NUM_FOLDS = opts.num_folds;
+	const int NUM_JOBS = NUM_KS * NUM_FOLDS * opts.num_restarts;
+
+	std::vector<HeldOutGenos<Genos>> folds;
+	std::vector<int64_t> num_held_out(NUM_FOLDS);
+	{
+		ThreadPool pool(num_threads);
+		for (int f = 0; f < NUM_FOLDS; ++f) {
+			folds.emplace_back(genos, GetMaskSeed(opts.seed), f, opts.cv_fraction);
+			num_held_out[f] = CountHeldOut(folds[f], opts, pool);
+			logger << Time << " Fold " << f << " holds out " << num_held_out[f] << " calls" << std::endl;
+			if (num_held_out[f] == 0) {
+				logger << Time << ' ' << warning << " Fold " << f << " holds out no call, use a larger --cv-fraction!" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	logger << Time << " Cross-validating K = " << MIN_K << " .. " << MAX_K << " on " << NUM_FOLDS << " folds of "
+		<< 100.0 * opts.cv_fraction << "% held out with " << opts.num_restarts << " restarts each in "
+		<< std::min(NUM_JOBS, num_threads) << " groups . . ." << std::endl;
+
+	std::vector<CVResult> results(NUM_KS * NUM_FOLDS);
+	std::vector<bool> has_result(results.size(), false);
+	std::mutex mtx;
+	const VBOptions JOB_OPTS = GetJobOptions(opts, NUM_JOBS, num_threads);
+	RunJobs(NUM_JOBS, num_threads, [&](int job, ThreadPool& pool) {
+		const int K = MAX_K - job / (NUM_FOLDS * opts.num_restarts);
+		const int FOLD = job / opts.num_restarts % NUM_FOLDS;
+		const int RESTART = job % opts.num_restarts;
+		VBFit fit;
+		RunVB(folds[FOLD], K, GetFitSeed(opts.seed, K, RESTART), JOB_OPTS, pool, false, fit, nullptr, nullptr);
+		fit.result.restart = RESTART;
+		const double DEVIANCE = CalcHeldOutDeviance(folds[FOLD], fit.p, fit.q, JOB_OPTS, pool);
+
+		std::lock_guard<std::mutex> lock(mtx);
+		const VBResult& RES = fit.result;
+		logger << Time << " K:" << K << "     fold:" << FOLD << "     restart:" << RESTART << "     LLBO:" << RES.llbo
+			<< "     iters:" << RES.num_iters << (RES.is_converged ? " (converged)" : "") << "     deviance/geno:"
+			<< DEVIANCE / num_held_out[FOLD] << "     " << RES.seconds << " s" << std::endl;
+
+		// The earliest restart wins ties, so the result does not depend on the finishing order.
+		const int IDX = (K - MIN_K) * NUM_FOLDS + FOLD;
+		CVResult& best = results[IDX];
+		if (!has_result[IDX] || RES.llbo > best.result.llbo
+				|| (RES.llbo == best.result.llbo && RESTART < best.result.restart)) {
+			best.result = RES;
+			best.deviance = DEVIANCE;
+			has_result[IDX] = true;
+		}
+	});
+
+	// Mean and standard error over the folds of the deviance per held-out call.
+	std::vector<double> means(NUM_KS, 0.0), std_errs(NUM_KS, 0.0);
+	for (int i = 0; i < NUM_KS; ++i) {
+		for (int f = 0; f < NUM_FOLDS; ++f)
+			means[i] += results[i * NUM_FOLDS + f].deviance / num_held_out[f] / NUM_FOLDS;
+		if (NUM_FOLDS > 1) {
+			double sm_sq = 0;
+			for (int f = 0; f < NUM_FOLDS; ++f) {
+				const double DIFF = results[i * NUM_FOLDS + f].deviance / num_held_out[f] - means[i];
+				sm_sq += DIFF * DIFF;
+			}
+			std_errs[i] = std::sqrt(sm_sq / (NUM_FOLDS - 1) / NUM_FOLDS);
+		}
+	}
+	std::vector<int> ranks(NUM_KS);
+	std::iota(ranks.begin(), ranks.end(), 0);
+	std::stable_sort(ranks.begin(), ranks.end(), [&](int a, int b) { return means[a] < means[b]; });
+
+	char buf[128];
+	logger << Time << " Held-out deviance per call, mean over " << NUM_FOLDS << " folds:" << std::endl;
+	logger << "    RANK     K        DEVIANCE       STD_ERR" << std::endl;
+	for (int r = 0; r < NUM_KS; ++r) {
+		snprintf(buf, sizeof(buf), "    %4d  %4d  %14.8f  %12.8f", r + 1, MIN_K + ranks[r], means[ranks[r]], std_errs[ranks[r]]);
+		logger << buf << std::endl;
+	}
+	logger << Time << " Best K: " << MIN_K + ranks[0] << std::endl;
+
+	if (!DumpCrossValidation(DUMP_PATH + "cv.txt", results, num_held_out)) {
+		logger << Time << ' ' << warning << " Could not open output file for dumping the cross-validation!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// Runs the projection, the cross-validation or the fits that the options ask for.
+template <typename Genos>
+static bool Run(const Genos& genos, const VBOptions& opts, int num_threads)
+{
+	if (opts.project_path != nullptr)
+		return RunProjection(genos, opts, num_threads);
+	if (opts.IsCrossValidation())
+		return RunCrossValidation(genos, opts, num_threads);
+	return RunFits(genos, opts, num_threads);
+}
+
+/// Logs what only a mapped file can tell. A PLINK fileset has no K.
+static void LogMappedGenos(const MappedGenosMatrix& genos, const VBOptions& opts)
+{
+	if (!genos.IsPlink())
+		return;
+
+	logger << "  Format:      PLINK .bed, G = copies of A2" << std::endl;
+	if (!opts.IsSweep() && opts.project_path == nullptr && opts.pack_path == nullptr)
+		logger << Time << ' ' << warning << " A PLINK fileset holds no K, fitting K = 1; use --sweep KMIN KMAX." << std::endl;
+}
+
+/// Logs the missing calls of the genotypes: the total and the worst locus and individual.
+/// Missing calls are left out of the fits, an individual without any call keeps the prior Q.
+template <typename Genos>
+static void LogMissingness(const Genos& genos)
+{
+	std::vector<int> locus_missing, indiv_missing;
+	genos.GetMissingCounts(locus_missing, indiv_missing);
+	const int64_t NUM_MISSING = std::accumulate(locus_missing.begin(), locus_missing.end(), static_cast<int64_t>(0));
+	const double NUM_GENOS = static_cast<double>(genos.GetNumIndivs()) * genos.GetNumLoci();
+	logger << "  Missing:     " << NUM_MISSING << " (" << (NUM_GENOS > 0 ? 100.0 * NUM_MISSING / NUM_GENOS : 0.0) << "%)" << std::endl;
+	if (NUM_MISSING == 0)
+		return;
+
+	const auto MAX_LOCUS = std::max_element(locus_missing.begin(), locus_missing.end());
+	const auto MAX_INDIV = std::max_element(indiv_missing.begin(), indiv_missing.end());
+	logger << "    Loci:      " << locus_missing.size() - std::count(locus_missing.begin(), locus_missing.end(), 0)
+		<< " with missing calls, at most " << 100.0 * *MAX_LOCUS / genos.GetNumIndivs() << "% at locus " << MAX_LOCUS - locus_missing.begin() << std::endl;
+	logger << "    Indivs:    " << indiv_missing.size() - std::count(indiv_missing.begin(), indiv_missing.end(), 0)
+		<< " with missing calls, at most " << 100.0 * *MAX_INDIV / genos.GetNumLoci() << "% at indiv " << MAX_INDIV - indiv_missing.begin() << std::endl;
+	const int NUM_UNCALLED = static_cast<int>(std::count(indiv_missing.begin(), indiv_missing.end(), genos.GetNumLoci()));
+	if (NUM_UNCALLED > 0)
+		logger << Time << ' ' << warning << ' ' << NUM_UNCALLED << " individuals have no called genotype, their Q stays at the prior." << std::endl;
+}
+
+
+
+int main(int argc, char** argv)
+{
+	logger << std::endl << std::endl;
+	logger << "===== VB STRUCT =====" << std::endl;
+	logger << "Start : " << Time << std::endl;
+	logger << "sizeof(int)  : " << sizeof(int) << std::endl;
+	logger << "FLOAT TYPE   : " << (sizeof(FloatType) == sizeof(double) ? "double" : "float") << std::endl;
+	logger << "ACCUMULATION : " << GetAccumulationName() << std::endl;
+	logger << "SIMD MATH    : " << GetSimdInstructionSet() << " x" << GetSimdLanes() << std::endl;
+
+	VBOptions opts;
+	if (!ParseOptions(argc, argv, opts)) {
+		logger << "File name is required!" << std::endl;
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (opts.seed == 0) {
+		std::random_device rd;
+		opts.seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+
+	// Cross-validation fits every fold with plain streamed iterations on a view of the shared genotypes. A fit
+	// per (K, fold, restart) has no file of its own, so none is checkpointed or timed.
+	if (opts.IsCrossValidation()) {
+		if (opts.is_accelerated || opts.svi_batch > 0 || opts.checkpoint_path != nullptr || opts.is_timing)
+			logger << Time << ' ' << warning << " --accelerate, --svi, --checkpoint and --timings are ignored by --cv!" << std::endl;
+		opts.is_accelerated = false;
+		opts.svi_batch = 0;
+		opts.checkpoint_path = nullptr;
+		opts.is_resuming = false;
+		opts.is_timing = false;
+		opts.is_streaming = true;
+	}
+
+	// A packed genotype file is processed out of core, which is only implemented for plain streamed iterations.
+	// For SQUAREM and SVI it is copied into memory instead, a pass over the rows without any parsing.
+	// A PLINK .bed file is mapped the same way.
+	const bool IS_PACKED = MappedGenosMatrix::IsMappedFile(opts.genos_path);
+#ifdef READ_GENOTYPES_FROM_BINARY_FILE
+	const bool IS_MAPPED = false;
+#else
+	const bool IS_MAPPED = IS_PACKED && opts.pack_path == nullptr && !opts.is_accelerated && opts.svi_batch == 0;
+#endif
+	if (IS_MAPPED)
+		opts.is_streaming = true;
+
+	// A projection fits one Q against one P, none of the fitting strategies apply.
+	if (opts.project_path != nullptr) {
+		if (opts.IsSweep() || opts.num_restarts > 1 || opts.is_accelerated || opts.svi_batch > 0)
+			logger << Time << ' ' << warning << " --sweep, --restarts, --accelerate and --svi are ignored by --project!" << std::endl;
+		opts.min_clusters = opts.max_clusters = 0;
+		opts.num_restarts = 1;
+		opts.is_accelerated = false;
+		opts.svi_batch = 0;
+		opts.is_streaming = true;
+	}
+
+#ifdef DISABLE_PHASE_TIMERS
+	if (opts.is_timing) {
+		logger << Time << ' ' << warning << " --timings is ignored, the phase timers are compiled out!" << std::endl;
+		opts.is_timing = false;
+	}
+#endif
+
+	const int NUM_THREADS = opts.num_threads > 0 ? opts.num_threads : ThreadPool::GetHardwareThreads();
+	logger << "NUM_THREADS  : " << NUM_THREADS << std::endl;
+	logger << "GENOTYPES    : " << (IS_MAPPED ? "MAPPED, blocks of " + std::to_string(opts.block_loci) + " loci"
+		: IS_PACKED ? "IN MEMORY, packed file" : "IN MEMORY") << std::endl;
+	logger << "Z STORAGE    : " << (opts.is_streaming ? "STREAMED" : "STORED") << std::endl;
+	logger << "ACCELERATION : " << (opts.is_accelerated ? "SQUAREM" : "NONE") << std::endl;
+	if (opts.svi_batch > 0)
+		logger << "SVI          : batch " << opts.svi_batch << "   tau " << opts.svi_tau << "   kappa " << opts.svi_kappa << std::endl;
+	logger << "MAX_ITERS    : " << opts.max_iters << std::endl;
+	logger << "MIN_ITERS    : " << opts.min_iters << std::endl;
+	logger << "LLBO_UPDATE  : " << opts.llbo_every << std::endl;
+	logger << "LLBO_EPSILON : " << opts.epsilon << std::endl;
+	logger << "RESTARTS     : " << opts.num_restarts << std::endl;
+	logger << "SEED         : " << opts.seed << std::endl;
+	if (opts.IsCrossValidation())
+		logger << "CV           : " << opts.num_folds << " folds, " << opts.cv_fraction << " held out" << std::endl;
+	if (opts.project_path != nullptr)
+		logger << "PROJECT      : " << opts.project_path << std::endl;
+	logger << "PROPS        : " << (opts.is_binary_props ? "BINARY" : "TEXT") << std::endl;
+	if (opts.is_timing)
+		logger << "TIMINGS      : " << TIMINGS_PATH << std::endl;
+	if (opts.checkpoint_path != nullptr)
+		logger << "CHECKPOINT   : " << opts.checkpoint_path << "   every " << opts.checkpoint_every << " iters / "
+			<< opts.checkpoint_seconds << " s" << (opts.is_resuming ? "   RESUME" : "") << std::endl;
+	logger << std::endl;
+
+	if (IS_MAPPED) {
+		logger << Time << " Mapping packed genotype file -> " << opts.genos_path << std::endl;
+		MappedGenosMatrix mapped_genos;
+		if (!mapped_genos.Open(opts.genos_path)) {
+			logger << "Could not map `" << opts.genos_path << "' file!" << std::endl;
+			return 2;
+		}
+		logger << "  NumIndivs:   " << mapped_genos.GetNumIndivs() << std::endl;
+		logger << "  NumLoci:     " << mapped_genos.GetNumLoci() << std::endl;
+		logger << "  NumClusters: " << mapped_genos.GetNumClusters() << std::endl;
+		LogMappedGenos(mapped_genos, opts);
+		LogMissingness(mapped_genos);
+
+		if (!Run(mapped_genos, opts, NUM_THREADS))
+			return 3;
+		logger << "End : " << Time << std::endl << std::endl;
+		return 0;
+	}
+
+	BitGenosMatrix genos;
+#ifdef MAKE_RANDOM_FREQS
+	//Make frequencies.
+	FreqsVector freqs;
+	InitFreqs(freqs, NUM_CLUSTERS, NUM_LOCI);
+
+	// Make genotypes.
+	InitGenos(genos, freqs, NUM_INDIVS, NUM_LOCI);
+#else
+	if (IS_PACKED) {
+		// The whole file is read anyway, so its checksum is checked on the way.
+		logger << Time << " Loading packed genotype file -> " << opts.genos_path << std::endl;
+		MappedGenosMatrix mapped_genos;
+		if (!mapped_genos.Open(opts.genos_path)) {
+			logger << "Could not map `" << opts.genos_path << "' file!" << std::endl;
+			return 2;
+		}
+		if (!mapped_genos.Verify()) {
+			logger << "Checksum of `" << opts.genos_path << "' file does not match, the file is damaged!" << std::endl;
+			return 2;
+		}
+		mapped_genos.CopyTo(genos);
+		LogMappedGenos(mapped_genos, opts);
+	} else {
+		// The text is mapped and decoded on all threads, into the packed rows directly.
+		logger << Time << " Reading from text file -> " << opts.genos_path << std::endl;
+		ThreadPool pool(NUM_THREADS);
+		if (!TextGenosFile::ReadFastStructure(opts.genos_path, genos, pool)) {
+			logger << "Could not read `" << opts.genos_path << "' file!" << std::endl;
+			return 2;
+		}
+	}
+#endif
+
+	logger << Time << "Reading genotype file is done!" << std::endl;
+	logger << "  NumIndivs:   " << genos.GetNumIndivs() << std::endl;
+	logger << "  NumLoci:     " << genos.GetNumLoci() << std::endl;
+	logger << "  NumClusters: " << genos.GetNumClusters() << std::endl;
+	logger << "  Monomorphic: " << CountMonomorphicLoci(genos) << std::endl;
+	LogMissingness(genos);
+
+	if (opts.pack_path != nullptr) {
+		logger << Time << " Writing packed genotype file -> " << opts.pack_path << std::endl;
+		MappedGenosMatrix packed_genos;
+		if (!MappedGenosMatrix::Write(opts.pack_path, genos) || !packed_genos.Open(opts.pack_path) || !packed_genos.Verify()) {
+			logger << "Could not write `" << opts.pack_path << "' file!" << std::endl;
+			return 2;
+		}
+		logger << "End : " << Time << std::endl << std::endl;
+		return 0;
+	}
+#ifdef MAKE_RANDOM_FREQS
+	freqs.clear();		// Clear useless frequencies.
+#endif
+
+	if (!Run(genos, opts, NUM_THREADS))
+		return 3;
 	logger << "End : " << Time << std::endl << std::endl;
 	return 0;
 }
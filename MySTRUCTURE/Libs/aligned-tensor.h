@@ -0,0 +1,146 @@
+#ifndef ALIGNED_TENSOR_H_
+#define ALIGNED_TENSOR_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+
+/// Contiguous row-major tensor of up to MAX_DIMS dimensions on a 64 byte aligned buffer.
+/// The innermost dimension can be padded to a whole number of SIMD registers, then every
+/// innermost row starts on an aligned address. Padding elements are always zero.
+template <typename T>
+class AlignedTensor
+{
+public:
+	typedef T ValueType;
+
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr int MAX_DIMS = 4;
+	static constexpr int SIMD_ELEMS = static_cast<int>(ALIGNMENT / sizeof(T));
+
+	AlignedTensor() : data(nullptr), size(0), num_dims(0), dims(), strides() {}
+
+	AlignedTensor(const AlignedTensor& other) : AlignedTensor() { *this = other; }
+
+	AlignedTensor(AlignedTensor&& other) noexcept : AlignedTensor() { Swap(other); }
+
+	~AlignedTensor() { Free(); }
+
+	AlignedTensor& operator=(const AlignedTensor& other)
+	{
+		if (this == &other)
+			return *this;
+
+		if (size != other.size) {
+			Free();
+			Allocate(other.size);
+		}
+		num_dims = other.num_dims;
+		std::copy(other.dims, other.dims + MAX_DIMS, dims);
+		std::copy(other.strides, other.strides + MAX_DIMS, strides);
+		if (size)
+			memcpy(data, other.data, size * sizeof(T));
+		return *this;
+	}
+
+	AlignedTensor& operator=(AlignedTensor&& other) noexcept
+	{
+		Swap(other);
+		return *this;
+	}
+
+	/// Allocates a zero filled tensor of the given dimensions.
+	/// If `is_padded' is true, the innermost dimension is rounded up to SIMD_ELEMS elements.
+	void Init(std::initializer_list<int> new_dims, bool is_padded = false)
+	{
+		num_dims = static_cast<int>(new_dims.size());
+		std::fill(dims, dims + MAX_DIMS, 1);
+		std::copy(new_dims.begin(), new_dims.end(), dims);
+
+		const size_t INNER_DIM = static_cast<size_t>(dims[num_dims - 1]);
+		strides[num_dims - 1] = 1;
+		size_t row_size = is_padded ? PadElems(INNER_DIM) : INNER_DIM;
+		for (int d = num_dims - 2; d >= 0; --d) {
+			strides[d] = row_size;
+			row_size *= static_cast<size_t>(dims[d]);
+		}
+
+		if (size != row_size) {
+			Free();
+			Allocate(row_size);
+		}
+		if (size)
+			memset(data, 0, size * sizeof(T));
+	}
+
+	inline int GetNumDims() const { return num_dims; }
+	inline int GetDim(int d) const { return dims[d]; }
+
+	/// Number of allocated elements, including padding.
+	inline size_t GetSize() const { return size; }
+
+	/// Distance between two consecutive innermost rows, including padding.
+	inline size_t GetRowStride() const { return num_dims > 1 ? strides[num_dims - 2] : size; }
+
+	inline T* GetData() { return data; }
+	inline const T* GetData() const { return data; }
+
+	/// Flat index of an element, or of the start of a row if fewer indices than dimensions are given.
+	template <typename... Idx>
+	inline size_t GetIdx(Idx... idx) const
+	{
+		const size_t IDX[] = { static_cast<size_t>(idx)... };
+		size_t res = 0;
+		for (size_t d = 0; d < sizeof...(Idx); ++d)
+			res += IDX[d] * strides[d];
+		return res;
+	}
+
+	template <typename... Idx>
+	inline T& operator()(Idx... idx) { return data[GetIdx(idx...)]; }
+
+	template <typename... Idx>
+	inline const T& operator()(Idx... idx) const { return data[GetIdx(idx...)]; }
+
+	template <typename... Idx>
+	inline T* GetRow(Idx... idx) { return data + GetIdx(idx...); }
+
+	template <typename... Idx>
+	inline const T* GetRow(Idx... idx) const { return data + GetIdx(idx...); }
+
+	static inline size_t PadElems(size_t num_elems) { return (num_elems + SIMD_ELEMS - 1) / SIMD_ELEMS * SIMD_ELEMS; }
+
+private:
+	void Allocate(size_t num_elems)
+	{
+		size = num_elems;
+		data = num_elems ? static_cast<T*>(::operator new[](num_elems * sizeof(T), std::align_val_t(ALIGNMENT))) : nullptr;
+	}
+
+	void Free()
+	{
+		if (data)
+			::operator delete[](data, std::align_val_t(ALIGNMENT));
+		data = nullptr;
+		size = 0;
+	}
+
+	void Swap(AlignedTensor& other)
+	{
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+		std::swap(num_dims, other.num_dims);
+		std::swap(dims, other.dims);
+		std::swap(strides, other.strides);
+	}
+
+	T* data;
+	size_t size;
+	int num_dims;
+	int dims[MAX_DIMS];
+	size_t strides[MAX_DIMS];
+};
+
+#endif
@@ -2,33 +2,73 @@
 #define BIT_GENOS_MATRIX_H_
 
 #include <climits>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <string>
-
-// Comment below line to reduce memory usage.
-#define USE_VECTOR_GENOS		1
-
-#ifdef USE_VECTOR_GENOS
 #include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
 #endif
 
+#include "aligned-tensor.h"
+
+/// Genotype matrix packed 2 bits per genotype, locus major.
+/// The row of a locus holds individual n in bits 2 (n % INDIVS_PER_WORD) of word n / INDIVS_PER_WORD.
+/// Every row starts on a 64 byte boundary and is zero padded to a whole number of ROW_ALIGN_WORDS,
+/// so a row can be processed a word, or a SIMD register of words, at a time.
+/// Genotypes are 0, 1 and 2; the fourth code, MISSING_GENO, marks a missing call.
 class BitGenosMatrix
 {
 public:
-	typedef unsigned int GenotypeMatrixType;
+	typedef uint64_t GenotypeMatrixType;
 
 	static constexpr int BITS_PER_GENOTYPE = 2;
 	static constexpr int GENOTYPE_MASK = (1 << BITS_PER_GENOTYPE) - 1;
 	static constexpr int INDIVS_PER_WORD = sizeof(GenotypeMatrixType) * CHAR_BIT / BITS_PER_GENOTYPE;
+	static constexpr int ROW_ALIGN_WORDS = AlignedTensor<GenotypeMatrixType>::SIMD_ELEMS;
+
+	static constexpr int NUM_GENOTYPES = 3;
+	static constexpr int MISSING_GENO = GENOTYPE_MASK;
+
+	// Low bit of every genotype slot in a word: 0b...0101.
+	static constexpr GenotypeMatrixType LOW_BITS = ~static_cast<GenotypeMatrixType>(0) / GENOTYPE_MASK;
+
+	/// Words of a locus row, including the padding.
+	static inline int GetWordsPerRow(int num_indivs)
+	{
+		const int NUM_WORDS = (num_indivs + INDIVS_PER_WORD - 1) / INDIVS_PER_WORD;
+		return (NUM_WORDS + ROW_ALIGN_WORDS - 1) / ROW_ALIGN_WORDS * ROW_ALIGN_WORDS;
+	}
+
+	/// Individuals of one locus grouped by genotype, each group in increasing order.
+	class LocusClasses
+	{
+	public:
+		inline int GetCount(int geno) const { return offsets[geno + 1] - offsets[geno]; }
+		inline const int* Begin(int geno) const { return indivs.data() + offsets[geno]; }
+		inline const int* End(int geno) const { return indivs.data() + offsets[geno + 1]; }
 
-	static inline int GetWordsPerRow(int num_indivs) { return (num_indivs + INDIVS_PER_WORD) / INDIVS_PER_WORD; }
+		/// True if every called individual has the same genotype.
+		inline bool IsMonomorphic() const
+		{
+			const int NUM_INDIVS = offsets[NUM_GENOTYPES];
+			for (int g = 0; g < NUM_GENOTYPES; ++g)
+				if (GetCount(g) == NUM_INDIVS)
+					return true;
+			return false;
+		}
+
+	private:
+		friend class BitGenosMatrix;
+
+		std::vector<int> indivs;
+		int offsets[NUM_GENOTYPES + 1];
+	};
 
 	BitGenosMatrix()
 		: num_cluster_indivs(0), num_loci(0), num_clusters(0), num_indivs(0), num_words_per_row(0)
-#ifndef USE_VECTOR_GENOS
-		, genos(nullptr)
-#endif
 	{}
 
 	BitGenosMatrix(int num_indivs, int num_loci, int num_clusters)
@@ -36,64 +76,156 @@ public:
 		, num_loci(num_loci)
 		, num_clusters(num_clusters)
 		, num_indivs(num_cluster_indivs * num_clusters)
-		, num_words_per_row(GetWordsPerRow(num_indivs))
-#ifndef USE_VECTOR_GENOS
-		, genos(nullptr)
-#endif
+		, num_words_per_row(GetWordsPerRow(this->num_indivs))
 	{
 		Init();
 	}
 
-	~BitGenosMatrix()
-	{
-#ifndef USE_VECTOR_GENOS
-		delete[] genos;
-		genos = nullptr;
-#endif
-	}
-
 	void Init(int num_indivs, int num_loci, int num_clusters)
 	{
-#ifdef USE_VECTOR_GENOS
-		genos.clear();
-#endif
-
 		num_cluster_indivs = num_indivs;
 		this->num_loci = num_loci;
 		this->num_clusters = num_clusters;
 		this->num_indivs = num_cluster_indivs * num_clusters;
-		num_words_per_row = GetWordsPerRow(num_indivs);
+		num_words_per_row = GetWordsPerRow(this->num_indivs);
 		Init();
 	}
 
 	inline int GetNumIndivs() const { return num_indivs; }
 	inline int GetNumLoci() const { return num_loci; }
 	inline int GetNumClusters() const { return num_clusters; }
+	inline int GetNumWordsPerRow() const { return num_words_per_row; }
 
 	inline int GetGeno(int indiv, int locus) const
 	{
-#ifdef USE_VECTOR_GENOS
-		return genos[indiv][locus];
-#else
-		const int LOCUS_IDX = GetLocusIdx(locus);
-		const int INDIV_IDX = GetIndivIdx(indiv);
+		const GenotypeMatrixType WORD = GetLocusRow(locus)[GetIndivIdx(indiv)];
+		return static_cast<int>(WORD >> GetBitNum(indiv)) & GENOTYPE_MASK;
+	}
+
+	inline void SetGeno(int indiv, int locus, int val)
+	{
+		GenotypeMatrixType& word = GetLocusRow(locus)[GetIndivIdx(indiv)];
 		const int BIT_NUM = GetBitNum(indiv);
-		const int GENO = genos[LOCUS_IDX + INDIV_IDX] >> BIT_NUM;
-		return GENO & GENOTYPE_MASK;
+		word &= ~(static_cast<GenotypeMatrixType>(GENOTYPE_MASK) << BIT_NUM);
+		word |= static_cast<GenotypeMatrixType>(val) << BIT_NUM;
+	}
+
+	/// The GetNumWordsPerRow() packed words of a locus, 64 byte aligned.
+	/// Slots of individuals past the last one are zero and must stay zero.
+	inline const GenotypeMatrixType* GetLocusRow(int locus) const { return genos.GetRow(locus); }
+	inline GenotypeMatrixType* GetLocusRow(int locus) { return genos.GetRow(locus); }
+
+	/// Copies the packed genotypes of a locus, INDIVS_PER_WORD individuals per word, into `words'.
+	inline void GetLocusWords(int locus, GenotypeMatrixType* words) const
+	{
+		memcpy(words, GetLocusRow(locus), num_words_per_row * sizeof(GenotypeMatrixType));
+	}
+
+	/// Low bits of the slots of word `w' of a row that hold an individual.
+	inline GenotypeMatrixType GetValidMask(int w) const
+	{
+		const int NUM_VALID = GetNumIndivs() - w * INDIVS_PER_WORD;
+		if (NUM_VALID >= INDIVS_PER_WORD)
+			return LOW_BITS;
+		if (NUM_VALID <= 0)
+			return 0;
+		return LOW_BITS & ((static_cast<GenotypeMatrixType>(1) << (NUM_VALID * BITS_PER_GENOTYPE)) - 1);
+	}
+
+	/// Marks the low bit of every slot of `word' holding genotype 0, 1 or 2; missing slots are in no class.
+	static inline void GetClassMasks(GenotypeMatrixType word, GenotypeMatrixType valid, GenotypeMatrixType* masks)
+	{
+		const GenotypeMatrixType LO = word & valid;
+		const GenotypeMatrixType HI = (word >> 1) & valid;
+		masks[0] = valid & ~(LO | HI);
+		masks[1] = LO & ~HI;
+		masks[2] = HI & ~LO;
+	}
+
+	/// Marks the low bit of every slot of `word' holding MISSING_GENO.
+	static inline GenotypeMatrixType GetMissingMask(GenotypeMatrixType word, GenotypeMatrixType valid)
+	{
+		return word & (word >> 1) & valid;
+	}
+
+	/// Number of individuals with genotype 0, 1 and 2 at a locus, by popcount of the class masks.
+	inline void GetLocusCounts(int locus, int* counts) const
+	{
+		const GenotypeMatrixType* ROW = GetLocusRow(locus);
+		counts[0] = counts[1] = counts[2] = 0;
+		const int NUM_WORDS = (GetNumIndivs() + INDIVS_PER_WORD - 1) / INDIVS_PER_WORD;
+		for (int w = 0; w < NUM_WORDS; ++w) {
+			GenotypeMatrixType masks[NUM_GENOTYPES];
+			GetClassMasks(ROW[w], GetValidMask(w), masks);
+			for (int g = 0; g < NUM_GENOTYPES; ++g)
+				counts[g] += PopCount(masks[g]);
+		}
+	}
+
+	/// Number of copies of allele 1 at a locus, sum_n G_{nl} over the called individuals; padding slots are zero and add nothing.
+	inline int GetLocusAlleleCount(int locus) const
+	{
+		const GenotypeMatrixType* ROW = GetLocusRow(locus);
+		int sm = 0;
+		for (int w = 0; w < num_words_per_row; ++w)
+			sm += PopCount(ROW[w] & LOW_BITS) + 2 * PopCount((ROW[w] >> 1) & LOW_BITS) - 3 * PopCount(GetMissingMask(ROW[w], LOW_BITS));
+		return sm;
+	}
+
+	/// Number of missing calls at every locus and of every individual, one pass over the packed rows.
+	/// Only words with a missing call are visited slot by slot.
+	inline void GetMissingCounts(std::vector<int>& locus_missing, std::vector<int>& indiv_missing) const
+	{
+		locus_missing.assign(GetNumLoci(), 0);
+		indiv_missing.assign(GetNumIndivs(), 0);
+		for (int l = 0; l < GetNumLoci(); ++l) {
+			const GenotypeMatrixType* ROW = GetLocusRow(l);
+			for (int w = 0; w < num_words_per_row; ++w)
+				for (GenotypeMatrixType m = GetMissingMask(ROW[w], LOW_BITS); m; m &= m - 1) {
+					++locus_missing[l];
+					++indiv_missing[w * INDIVS_PER_WORD + CountTrailingZeros(m) / BITS_PER_GENOTYPE];
+				}
+		}
+	}
+
+	/// Groups the individuals of a locus by genotype with mask and popcount operations on the packed words.
+	inline void GetLocusClasses(int locus, LocusClasses& classes) const
+	{
+		classes.indivs.resize(GetNumIndivs());
+		GetLocusCounts(locus, classes.offsets + 1);
+		classes.offsets[0] = 0;
+		for (int g = 0; g < NUM_GENOTYPES; ++g)
+			classes.offsets[g + 1] += classes.offsets[g];
+
+		const GenotypeMatrixType* ROW = GetLocusRow(locus);
+		const int NUM_WORDS = (GetNumIndivs() + INDIVS_PER_WORD - 1) / INDIVS_PER_WORD;
+		int pos[NUM_GENOTYPES] = { classes.offsets[0], classes.offsets[1], classes.offsets[2] };
+		for (int w = 0; w < NUM_WORDS; ++w) {
+			GenotypeMatrixType masks[NUM_GENOTYPES];
+			GetClassMasks(ROW[w], GetValidMask(w), masks);
+			for (int g = 0; g < NUM_GENOTYPES; ++g)
+				for (GenotypeMatrixType m = masks[g]; m; m &= m - 1)
+					classes.indivs[pos[g]++] = w * INDIVS_PER_WORD + CountTrailingZeros(m) / BITS_PER_GENOTYPE;
+		}
+	}
+
+	static inline int PopCount(GenotypeMatrixType x)
+	{
+#ifdef _MSC_VER
+		return static_cast<int>(__popcnt64(x));
+#else
+		return __builtin_popcountll(x);
 #endif
 	}
 
-	inline void SetGeno(int indiv, int locus, int val)
+	static inline int CountTrailingZeros(GenotypeMatrixType x)
 	{
-#ifdef USE_VECTOR_GENOS
-		genos[indiv][locus] = static_cast<unsigned char>(val);
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward64(&idx, x);
+		return static_cast<int>(idx);
 #else
-		const int LOCUS_IDX = GetLocusIdx(locus);
-		const int INDIV_IDX = GetIndivIdx(indiv);
-		const int BIT_NUM = GetBitNum(indiv);
-		const int GENO_IDX = LOCUS_IDX + INDIV_IDX;
-		genos[GENO_IDX] &= ~(GENOTYPE_MASK << BIT_NUM);
-		genos[GENO_IDX] |= val << BIT_NUM;
+		return __builtin_ctzll(x);
 #endif
 	}
 
@@ -103,8 +235,8 @@ public:
 		if (!genos_file.is_open())
 			return false;
 
-		// Dump configs.
-		genos_file << "NUM_INDIVS: " << GetNumIndivs() << std::endl;
+		// Dump configs. NUM_INDIVS counts the individuals of each cluster, as the text loaders read it.
+		genos_file << "NUM_INDIVS: " << num_cluster_indivs << std::endl;
 		genos_file << "NUM_LOCI: " << GetNumLoci() << std::endl;
 		genos_file << "NUM_CLUSTERS: " << GetNumClusters() << std::endl;
 		genos_file << std::endl;
@@ -119,58 +251,14 @@ public:
 		return true;
 	}
 
-	inline bool ReadFromTextFile(std::string path)
-	{
-#ifdef USE_VECTOR_GENOS
-		genos.clear();
-#endif
-
-		std::ifstream genos_file(path);
-		if (!genos_file.is_open())
-			return false;
-
-		// Read configs.
-		int num_indivs, num_loci, num_clusters;
-		std::string tmp_str;
-		genos_file >> tmp_str >> num_indivs >> tmp_str >> num_loci >> tmp_str >> num_clusters;
-
-		num_cluster_indivs = num_indivs;
-		this->num_loci = num_loci;
-		this->num_clusters = num_clusters;
-		this->num_indivs = num_indivs * num_clusters;
-		num_words_per_row = GetWordsPerRow(this->num_indivs);
-		Init();
-
-		// Read genotype.
-		char geno;
-		for (int i = 0; i < GetNumIndivs(); ++i)
-			for (int l = 0; l < GetNumLoci(); ++l) {
-				genos_file >> geno;
-				if (geno == '\r' || geno == '\n')
-					continue;
-
-				const int G = (geno == '0' ? 0 : geno == '1' ? 1 : 2);
-				SetGeno(i, l, G);
-			}
-		return true;
-	}
-
 private:
-	inline int GetLocusIdx(int locus) const { return num_words_per_row * locus; }
-	static inline int GetIndivIdx(int indiv) {	return indiv / INDIVS_PER_WORD; }
-	inline int GetBitNum(int indiv) const { return (indiv * BITS_PER_GENOTYPE) % (CHAR_BIT * sizeof(GenotypeMatrixType)); }
+	static inline int GetIndivIdx(int indiv) { return indiv / INDIVS_PER_WORD; }
+	static inline int GetBitNum(int indiv) { return indiv % INDIVS_PER_WORD * BITS_PER_GENOTYPE; }
 
 	void Init()
 	{
-#ifdef USE_VECTOR_GENOS
-		genos.resize(GetNumIndivs());
-		for (int i = 0; i < GetNumIndivs(); ++i)
-			genos[i].resize(GetNumLoci(), 0);
-#else
-		const int NUM_ITEMS = num_words_per_row * num_loci;
-		genos = new GenotypeMatrixType[NUM_ITEMS];
-		memset(genos, 0, NUM_ITEMS * sizeof(GenotypeMatrixType));
-#endif
+		// Rows are padded to ROW_ALIGN_WORDS, so num_words_per_row is the row stride of the tensor.
+		genos.Init({ GetNumLoci(), num_words_per_row });
 	}
 
 	int num_cluster_indivs;
@@ -178,12 +266,7 @@ private:
 	int num_clusters;
 	int num_indivs;
 	int num_words_per_row;
-
-#ifdef USE_VECTOR_GENOS
-	std::vector<std::vector<unsigned char>> genos;
-#else
-	GenotypeMatrixType* genos;
-#endif
+	AlignedTensor<GenotypeMatrixType> genos;
 };
 
 #endif
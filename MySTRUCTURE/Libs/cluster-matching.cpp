@@ -0,0 +1,85 @@
+#include "cluster-matching.h"
+
+#include <algorithm>
+#include <limits>
+
+void CountConfusion(const std::vector<int>& true_clusters, const std::vector<int>& found_clusters,
+	int num_true, int num_found, std::vector<std::vector<double>>& confusion)
+{
+	confusion.assign(num_true, std::vector<double>(num_found, 0.0));
+	const size_t NUM_INDIVS = std::min(true_clusters.size(), found_clusters.size());
+	for (size_t i = 0; i < NUM_INDIVS; ++i) {
+		const int T = true_clusters[i];
+		const int F = found_clusters[i];
+		if (T >= 0 && T < num_true && F >= 0 && F < num_found)
+			++confusion[T][F];
+	}
+}
+
+double MatchClusters(const std::vector<std::vector<double>>& weights, std::vector<int>& mapping)
+{
+	const int NUM_ROWS = static_cast<int>(weights.size());
+	const int NUM_COLS = NUM_ROWS > 0 ? static_cast<int>(weights[0].size()) : 0;
+	mapping.assign(NUM_ROWS, -1);
+	if (NUM_ROWS == 0 || NUM_COLS == 0)
+		return 0.0;
+
+	// The rectangular matrix is padded with zero weights to a square one, and the maximum is
+	// the minimum assignment of the costs -weight. Rows and columns are 1-based below, column 0 holds the row
+	// being added; u and v are the row and column potentials, way the previous column of the augmenting path.
+	const int SIZE = std::max(NUM_ROWS, NUM_COLS);
+	auto Cost = [&](int r, int c) { return r <= NUM_ROWS && c <= NUM_COLS ? -weights[r - 1][c - 1] : 0.0; };
+	const double INF = std::numeric_limits<double>::infinity();
+	std::vector<double> u(SIZE + 1, 0.0), v(SIZE + 1, 0.0), min_v(SIZE + 1);
+	std::vector<int> row_of(SIZE + 1, 0), way(SIZE + 1, 0);
+	std::vector<bool> is_used(SIZE + 1);
+	for (int r = 1; r <= SIZE; ++r) {
+		row_of[0] = r;
+		int c0 = 0;
+		std::fill(min_v.begin(), min_v.end(), INF);
+		std::fill(is_used.begin(), is_used.end(), false);
+		do {
+			is_used[c0] = true;
+			const int R0 = row_of[c0];
+			double delta = INF;
+			int c1 = 0;
+			for (int c = 1; c <= SIZE; ++c) {
+				if (is_used[c])
+					continue;
+				const double CUR = Cost(R0, c) - u[R0] - v[c];
+				if (CUR < min_v[c]) {
+					min_v[c] = CUR;
+					way[c] = c0;
+				}
+				if (min_v[c] < delta) {
+					delta = min_v[c];
+					c1 = c;
+				}
+			}
+			for (int c = 0; c <= SIZE; ++c) {
+				if (is_used[c]) {
+					u[row_of[c]] += delta;
+					v[c] -= delta;
+				} else
+					min_v[c] -= delta;
+			}
+			c0 = c1;
+		} while (row_of[c0] != 0);
+
+		do {
+			const int C1 = way[c0];
+			row_of[c0] = row_of[C1];
+			c0 = C1;
+		} while (c0 != 0);
+	}
+
+	double sum = 0.0;
+	for (int c = 1; c <= NUM_COLS; ++c) {
+		const int R = row_of[c];
+		if (R >= 1 && R <= NUM_ROWS) {
+			mapping[R - 1] = c - 1;
+			sum += weights[R - 1][c - 1];
+		}
+	}
+	return sum;
+}
@@ -0,0 +1,17 @@
+#ifndef CLUSTER_MATCHING_H_
+#define CLUSTER_MATCHING_H_
+
+#include <vector>
+
+/// Confusion matrix of a clustering, confusion[t][f] individuals of true cluster t put in found cluster f.
+/// Individuals with a cluster outside [0, num_true) or [0, num_found) are not counted.
+void CountConfusion(const std::vector<int>& true_clusters, const std::vector<int>& found_clusters,
+	int num_true, int num_found, std::vector<std::vector<double>>& confusion);
+
+/// Assignment of rows to columns that maximizes the sum of weights[r][mapping[r]], every column used at most
+/// once, found by the Hungarian algorithm in O(R^2 C) instead of trying all permutations. For a confusion
+/// matrix it is the labelling of the found clusters that agrees with the most individuals.
+/// mapping[r] is -1 for the rows left over when there are more rows than columns. Returns the sum.
+double MatchClusters(const std::vector<std::vector<double>>& weights, std::vector<int>& mapping);
+
+#endif
@@ -0,0 +1,80 @@
+#include "file-writer.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+BackgroundFileWriter::BackgroundFileWriter() : is_busy(false), is_failed(false) {}
+
+BackgroundFileWriter::~BackgroundFileWriter()
+{
+	Wait();
+}
+
+bool BackgroundFileWriter::TryWrite(const std::string& path, std::vector<char>& data)
+{
+	if (is_busy)
+		return false;
+	if (worker.joinable())
+		worker.join();
+
+	buffer.swap(data);
+	is_busy = true;
+	worker = std::thread([this, path]() {
+		if (!WriteAtomic(path, buffer))
+			is_failed = true;
+		is_busy = false;
+	});
+	return true;
+}
+
+bool BackgroundFileWriter::Wait()
+{
+	if (worker.joinable())
+		worker.join();
+	return !is_failed.exchange(false);
+}
+
+bool BackgroundFileWriter::WriteAtomic(const std::string& path, const std::vector<char>& data)
+{
+	const std::string TMP_PATH = path + ".tmp";
+	FILE* file = fopen(TMP_PATH.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	bool is_ok = fwrite(data.data(), 1, data.size(), file) == data.size() && fflush(file) == 0;
+#ifdef _WIN32
+	is_ok = is_ok && _commit(_fileno(file)) == 0;
+#else
+	is_ok = is_ok && fsync(fileno(file)) == 0;
+#endif
+	is_ok = fclose(file) == 0 && is_ok;
+	if (!is_ok) {
+		remove(TMP_PATH.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	return MoveFileExA(TMP_PATH.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(TMP_PATH.c_str(), path.c_str()) == 0;
+#endif
+}
+
+bool BackgroundFileWriter::ReadFile(const std::string& path, std::vector<char>& data)
+{
+	std::ifstream file(path, std::ios_base::binary | std::ios_base::ate);
+	if (!file.is_open())
+		return false;
+
+	data.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	return static_cast<bool>(file.read(data.data(), data.size()));
+}
@@ -0,0 +1,42 @@
+#ifndef FILE_WRITER_H_
+#define FILE_WRITER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Writes whole files atomically in a background thread.
+/// A file is written to `path'.tmp, flushed to the disk and renamed over `path', so `path'
+/// always holds the complete old or the complete new content, even if the process is killed.
+class BackgroundFileWriter
+{
+public:
+	BackgroundFileWriter();
+	~BackgroundFileWriter();
+
+	BackgroundFileWriter(const BackgroundFileWriter&) = delete;
+	BackgroundFileWriter& operator=(const BackgroundFileWriter&) = delete;
+
+	inline bool IsBusy() const { return is_busy; }
+
+	/// Starts writing `data' to `path' and returns at once, taking the buffer over.
+	/// Returns false and writes nothing if the previous write is still running.
+	bool TryWrite(const std::string& path, std::vector<char>& data);
+
+	/// Waits for the running write. Returns false if a write failed since the last call.
+	bool Wait();
+
+	/// Writes `data' to `path' atomically in the calling thread.
+	static bool WriteAtomic(const std::string& path, const std::vector<char>& data);
+
+	static bool ReadFile(const std::string& path, std::vector<char>& data);
+
+private:
+	std::thread worker;
+	std::vector<char> buffer;
+	std::atomic<bool> is_busy;
+	std::atomic<bool> is_failed;
+};
+
+#endif
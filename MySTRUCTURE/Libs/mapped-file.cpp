@@ -0,0 +1,140 @@
+#include "mapped-file.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+size_t GetPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+}
+
+MappedFile::MappedFile()
+	: data(nullptr), num_bytes(0)
+#ifdef _WIN32
+	, file_handle(nullptr), mapping_handle(nullptr)
+#else
+	, fd(-1)
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_handle, &size) || size.QuadPart <= 0) {
+		Close();
+		return false;
+	}
+	num_bytes = static_cast<size_t>(size.QuadPart);
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr) {
+		Close();
+		return false;
+	}
+	data = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+#else
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		Close();
+		return false;
+	}
+	num_bytes = static_cast<size_t>(st.st_size);
+	void* addr = mmap(nullptr, num_bytes, PROT_READ, MAP_SHARED, fd, 0);
+	data = addr == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(addr);
+#endif
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != nullptr)
+		CloseHandle(file_handle);
+	mapping_handle = file_handle = nullptr;
+#else
+	if (data != nullptr)
+		munmap(const_cast<unsigned char*>(data), num_bytes);
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	data = nullptr;
+	num_bytes = 0;
+}
+
+void MappedFile::Advise(size_t first_byte, size_t last_byte, bool will_need) const
+{
+	if (!IsOpen() || first_byte >= last_byte)
+		return;
+
+	// The OS works on whole pages. A released range keeps the pages it shares with its
+	// neighbours, so a block never drops the first or last bytes of the next one.
+	static const size_t PAGE_SIZE = GetPageSize();
+	size_t first_page, last_page;
+	if (will_need) {
+		first_page = first_byte / PAGE_SIZE * PAGE_SIZE;
+		last_page = std::min(num_bytes, (last_byte + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE);
+	} else {
+		first_page = (first_byte + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+		last_page = last_byte / PAGE_SIZE * PAGE_SIZE;
+	}
+	if (first_page >= last_page)
+		return;
+
+	void* addr = const_cast<unsigned char*>(data + first_page);
+	const size_t LENGTH = last_page - first_page;
+#ifdef _WIN32
+	// Pages of a read-only view are dropped by the memory manager when needed, only the prefetch is explicit.
+	if (will_need) {
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = addr;
+		range.NumberOfBytes = LENGTH;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	madvise(addr, LENGTH, will_need ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+}
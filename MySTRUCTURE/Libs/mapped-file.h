@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+/// Whole file mapped read-only into the address space.
+/// Pages are loaded by the OS on first access, so opening a file reads nothing.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/// Maps the file at `path'. Returns false if it can not be opened or mapped; an empty file can not be mapped.
+	bool Open(const std::string& path);
+	void Close();
+
+	inline bool IsOpen() const { return data != nullptr; }
+	inline const unsigned char* GetData() const { return data; }
+	inline size_t GetSize() const { return num_bytes; }
+
+	/// Asks the OS to read bytes [first_byte, last_byte) in the background, or to drop them from the
+	/// resident set of the process. Dropping keeps the pages shared with the bytes around the range.
+	void Advise(size_t first_byte, size_t last_byte, bool will_need) const;
+
+private:
+	const unsigned char* data;
+	size_t num_bytes;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,311 @@
+#include "mapped-genos.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+
+inline uint32_t ReadUInt32(const unsigned char* p)
+{
+	return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+		| static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint64_t ReadUInt64(const unsigned char* p)
+{
+	return static_cast<uint64_t>(ReadUInt32(p)) | static_cast<uint64_t>(ReadUInt32(p + 4)) << 32;
+}
+
+inline void WriteUInt32(unsigned char* p, uint32_t x)
+{
+	for (int i = 0; i < 4; ++i)
+		p[i] = static_cast<unsigned char>(x >> (8 * i));
+}
+
+inline void WriteUInt64(unsigned char* p, uint64_t x)
+{
+	WriteUInt32(p, static_cast<uint32_t>(x));
+	WriteUInt32(p + 4, static_cast<uint32_t>(x >> 32));
+}
+
+/// `path' with its extension replaced by `ext'.
+std::string ReplaceExtension(const std::string& path, const char* ext)
+{
+	const size_t DOT = path.find_last_of('.');
+	const size_t SLASH = path.find_last_of("/\\");
+	const bool HAS_EXT = DOT != std::string::npos && (SLASH == std::string::npos || DOT > SLASH);
+	return (HAS_EXT ? path.substr(0, DOT) : path) + ext;
+}
+
+/// Number of non-empty lines of a text file, -1 if it can not be opened.
+int CountLines(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+		return -1;
+
+	int num_lines = 0;
+	std::string line;
+	while (std::getline(file, line))
+		num_lines += line.find_first_not_of(" \t\r") != std::string::npos;
+	return num_lines;
+}
+
+}
+
+MappedGenosMatrix::MappedGenosMatrix()
+	: data(nullptr), num_bytes(0), header_bytes(HEADER_BYTES), is_plink(false), geno_codes{ 0, 1, 2, 3 }, version(0), checksum(0), num_indivs(0), num_loci(0), num_clusters(0), bytes_per_locus(0)
+{}
+
+MappedGenosMatrix::~MappedGenosMatrix()
+{
+	Close();
+}
+
+bool MappedGenosMatrix::Open(const std::string& path)
+{
+	Close();
+	if (!Map(path))
+		return false;
+
+	const bool IS_OK = num_bytes >= sizeof(PLINK_MAGIC) && memcmp(data, PLINK_MAGIC, sizeof(PLINK_MAGIC)) == 0
+		? ReadPlinkHeader(path) : ReadHeader();
+	if (!IS_OK)
+		Close();
+	return IS_OK;
+}
+
+bool MappedGenosMatrix::Map(const std::string& path)
+{
+	if (!file.Open(path) || file.GetSize() < PLINK_HEADER_BYTES) {
+		file.Close();
+		return false;
+	}
+	data = file.GetData();
+	num_bytes = file.GetSize();
+	return true;
+}
+
+bool MappedGenosMatrix::ReadHeader()
+{
+	if (num_bytes < HEADER_BYTES)
+		return false;
+	version = ReadUInt32(data + 8);
+	if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || version < 1 || version > VERSION)
+		return false;
+	num_indivs = static_cast<int>(ReadUInt32(data + 12));
+	num_loci = static_cast<int>(ReadUInt32(data + 16));
+	num_clusters = static_cast<int>(ReadUInt32(data + 20));
+	bytes_per_locus = static_cast<int>(ReadUInt32(data + 24));
+	const uint32_t LAYOUT = version >= 2 ? ReadUInt32(data + 28) : LAYOUT_LOCUS_MAJOR_2BIT;
+	checksum = version >= 2 ? ReadUInt64(data + 32) : 0;
+	return LAYOUT == LAYOUT_LOCUS_MAJOR_2BIT && bytes_per_locus == GetBytesPerLocus(num_indivs)
+		&& num_bytes >= HEADER_BYTES + static_cast<size_t>(bytes_per_locus) * num_loci;
+}
+
+bool MappedGenosMatrix::ReadPlinkHeader(const std::string& bed_path)
+{
+	// PLINK codes: 00 homozygous A1, 01 missing, 10 heterozygous, 11 homozygous A2.
+	static constexpr int PLINK_CODES[] = { 0, MISSING_GENO, 1, 2 };
+	const int NUM_INDIVS = CountLines(ReplaceExtension(bed_path, ".fam"));
+	const int NUM_LOCI = CountLines(ReplaceExtension(bed_path, ".bim"));
+	if (NUM_INDIVS < 0 || NUM_LOCI < 0)
+		return false;
+
+	is_plink = true;
+	header_bytes = PLINK_HEADER_BYTES;
+	std::copy(PLINK_CODES, PLINK_CODES + 4, geno_codes);
+	num_indivs = NUM_INDIVS;
+	num_loci = NUM_LOCI;
+	num_clusters = 1;
+	bytes_per_locus = (NUM_INDIVS + INDIVS_PER_BYTE - 1) / INDIVS_PER_BYTE;
+	return num_bytes == PLINK_HEADER_BYTES + static_cast<size_t>(bytes_per_locus) * num_loci;
+}
+
+void MappedGenosMatrix::Close()
+{
+	file.Close();
+	data = nullptr;
+	num_bytes = 0;
+	header_bytes = HEADER_BYTES;
+	is_plink = false;
+	for (int g = 0; g <= BitGenosMatrix::GENOTYPE_MASK; ++g)
+		geno_codes[g] = g;
+	version = 0;
+	checksum = 0;
+	num_indivs = num_loci = num_clusters = bytes_per_locus = 0;
+}
+
+void MappedGenosMatrix::Prefetch(int first_locus, int last_locus) const
+{
+	Advise(first_locus, last_locus, true);
+}
+
+void MappedGenosMatrix::Release(int first_locus, int last_locus) const
+{
+	Advise(first_locus, last_locus, false);
+}
+
+void MappedGenosMatrix::Advise(int first_locus, int last_locus, bool will_need) const
+{
+	if (!IsOpen() || first_locus >= last_locus)
+		return;
+
+	file.Advise(GetLocusRow(first_locus) - data, GetLocusRow(last_locus) - data, will_need);
+}
+
+bool MappedGenosMatrix::Verify() const
+{
+	if (!IsOpen())
+		return false;
+	if (version < 2 || is_plink)
+		return true;
+	return GetChecksum(GetLocusRow(0), static_cast<size_t>(bytes_per_locus) * num_loci) == checksum;
+}
+
+void MappedGenosMatrix::CopyTo(BitGenosMatrix& genos) const
+{
+	// A packed word is 8 bytes of the file row, least significant first. Only the bytes of the first
+	// bytes_per_locus / 8 words are in the file, the rest of the padded row stays zero.
+	typedef BitGenosMatrix::GenotypeMatrixType Word;
+	static constexpr int BYTES_PER_WORD = sizeof(Word);
+	// BitGenosMatrix holds K clusters of equal size; other files are read as one cluster.
+	const int K = num_clusters > 0 && num_indivs % num_clusters == 0 ? num_clusters : 1;
+	genos.Init(num_indivs / K, num_loci, K);
+	for (int l = 0; l < num_loci; ++l) {
+		const unsigned char* ROW = GetLocusRow(l);
+		Word* words = genos.GetLocusRow(l);
+		for (int b = 0; b < bytes_per_locus; ++b)
+			words[b / BYTES_PER_WORD] |= static_cast<Word>(ROW[b]) << (b % BYTES_PER_WORD * CHAR_BIT);
+		if (!is_plink)
+			continue;
+
+		// PLINK code (hi, lo) to G (lo, hi ^ lo): 00 -> 0, 10 -> 1, 11 -> 2, 01 -> 3, for 32 slots at once.
+		for (int w = 0; w < genos.GetNumWordsPerRow(); ++w) {
+			const Word LO = words[w] & BitGenosMatrix::LOW_BITS;
+			const Word HI = (words[w] >> 1) & BitGenosMatrix::LOW_BITS;
+			words[w] = ((LO << 1) | (HI ^ LO)) & genos.GetValidMask(w) * BitGenosMatrix::GENOTYPE_MASK;
+		}
+	}
+}
+
+int64_t MappedGenosMatrix::CountMissing() const
+{
+	// Missing calls per byte of the rows; padding slots are 00, which is never the missing code.
+	int missing_per_byte[256];
+	for (int b = 0; b < 256; ++b) {
+		missing_per_byte[b] = 0;
+		for (int i = 0; i < INDIVS_PER_BYTE; ++i)
+			missing_per_byte[b] += geno_codes[(b >> (i * BitGenosMatrix::BITS_PER_GENOTYPE)) & BitGenosMatrix::GENOTYPE_MASK]
+				== MISSING_GENO;
+	}
+
+	int64_t num_missing = 0;
+	const unsigned char* END = GetLocusRow(num_loci);
+	for (const unsigned char* b = GetLocusRow(0); b != END; ++b)
+		num_missing += missing_per_byte[*b];
+	return num_missing;
+}
+
+void MappedGenosMatrix::GetMissingCounts(std::vector<int>& locus_missing, std::vector<int>& indiv_missing) const
+{
+	// Bit i of missing_slots[b] is set if slot i of byte b is a missing call.
+	unsigned char missing_slots[256];
+	for (int b = 0; b < 256; ++b) {
+		missing_slots[b] = 0;
+		for (int i = 0; i < INDIVS_PER_BYTE; ++i)
+			if (geno_codes[(b >> (i * BitGenosMatrix::BITS_PER_GENOTYPE)) & BitGenosMatrix::GENOTYPE_MASK] == MISSING_GENO)
+				missing_slots[b] |= 1 << i;
+	}
+
+	locus_missing.assign(num_loci, 0);
+	indiv_missing.assign(num_indivs, 0);
+	for (int l = 0; l < num_loci; ++l) {
+		const unsigned char* ROW = GetLocusRow(l);
+		for (int b = 0; b < bytes_per_locus; ++b)
+			for (int slots = missing_slots[ROW[b]]; slots != 0; slots &= slots - 1) {
+				++locus_missing[l];
+				++indiv_missing[b * INDIVS_PER_BYTE + BitGenosMatrix::CountTrailingZeros(slots)];
+			}
+	}
+}
+
+bool MappedGenosMatrix::IsMappedFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios_base::binary);
+	char magic[sizeof(MAGIC)] = {};
+	file.read(magic, sizeof(magic));
+	return (file.gcount() == sizeof(MAGIC) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0)
+		|| (file.gcount() >= static_cast<std::streamsize>(sizeof(PLINK_MAGIC)) && memcmp(magic, PLINK_MAGIC, sizeof(PLINK_MAGIC)) == 0);
+}
+
+bool MappedGenosMatrix::ReadPlinkPhenotypes(const std::string& bed_path, std::vector<int>& phenotypes)
+{
+	// .fam columns: family id, individual id, father, mother, sex, phenotype.
+	std::ifstream file(ReplaceExtension(bed_path, ".fam"));
+	if (!file.is_open())
+		return false;
+
+	phenotypes.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+		std::istringstream fields(line);
+		std::string field;
+		for (int c = 0; c < 6 && fields >> field; ++c) {}
+		phenotypes.push_back(fields ? std::atoi(field.c_str()) : 0);
+	}
+	return true;
+}
+
+bool MappedGenosMatrix::Write(const std::string& path, const BitGenosMatrix& genos)
+{
+	std::ofstream file(path, std::ios_base::binary);
+	if (!file.is_open())
+		return false;
+
+	// Write header, the checksum is filled in after the loci.
+	unsigned char header[HEADER_BYTES] = {};
+	const int BYTES_PER_LOCUS = GetBytesPerLocus(genos.GetNumIndivs());
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	WriteUInt32(header + 8, VERSION);
+	WriteUInt32(header + 12, static_cast<uint32_t>(genos.GetNumIndivs()));
+	WriteUInt32(header + 16, static_cast<uint32_t>(genos.GetNumLoci()));
+	WriteUInt32(header + 20, static_cast<uint32_t>(genos.GetNumClusters()));
+	WriteUInt32(header + 24, static_cast<uint32_t>(BYTES_PER_LOCUS));
+	WriteUInt32(header + 28, LAYOUT_LOCUS_MAJOR_2BIT);
+	file.write(reinterpret_cast<const char*>(header), HEADER_BYTES);
+
+	// Write genotypes, one locus row at a time. Both layouts put individual n at bits 2 (n % 4) of byte n / 4,
+	// counting the bytes of a packed word from its least significant one, and both pad rows with zero bits.
+	static constexpr int BYTES_PER_WORD = sizeof(BitGenosMatrix::GenotypeMatrixType);
+	std::vector<unsigned char> row(BYTES_PER_LOCUS);
+	uint64_t hash = CHECKSUM_SEED;
+	for (int l = 0; l < genos.GetNumLoci(); ++l) {
+		const BitGenosMatrix::GenotypeMatrixType* WORDS = genos.GetLocusRow(l);
+		for (int b = 0; b < BYTES_PER_LOCUS; ++b)
+			row[b] = static_cast<unsigned char>(WORDS[b / BYTES_PER_WORD] >> (b % BYTES_PER_WORD * CHAR_BIT));
+		file.write(reinterpret_cast<const char*>(row.data()), BYTES_PER_LOCUS);
+		hash = GetChecksum(row.data(), row.size(), hash);
+	}
+
+	WriteUInt64(header + 32, hash);
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(header), HEADER_BYTES);
+	return static_cast<bool>(file);
+}
+
+uint64_t MappedGenosMatrix::GetChecksum(const unsigned char* bytes, size_t num_bytes, uint64_t hash)
+{
+	static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+	for (size_t i = 0; i < num_bytes; ++i)
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+	return hash;
+}
@@ -0,0 +1,131 @@
+#ifndef MAPPED_GENOS_H_
+#define MAPPED_GENOS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bit_genos_matrix.h"
+#include "mapped-file.h"
+
+/// Read-only genotype matrix backed by a memory-mapped packed genotype file.
+/// Nothing is read up front: pages are loaded by the OS when a locus is touched, so the
+/// matrix can be much larger than the memory. Loci are stored one after another, so a
+/// range of loci is a contiguous range of the file that can be prefetched and released.
+///
+/// File layout, all integers little endian:
+///   header   HEADER_BYTES bytes: MAGIC, uint32 version, num_indivs, num_loci, num_clusters, bytes_per_locus,
+///            layout, uint64 checksum (FNV-1a of the loci bytes), zero padding
+///   loci     num_loci rows of bytes_per_locus bytes, individual n in bits 2 (n % 4) of byte n / 4,
+///            padded with zero bits to a multiple of ROW_ALIGN bytes
+/// Version 1 files have no layout and checksum; they are read as LAYOUT_LOCUS_MAJOR_2BIT and never fail Verify.
+///
+/// A PLINK .bed file in SNP-major mode is mapped the same way: its rows have the same bit positions, only
+/// ceil(N / 4) bytes long after a PLINK_HEADER_BYTES header, and other codes. Genotypes are recoded on access,
+/// G = copies of the A2 allele of the .bim, and a missing call is MISSING_GENO. N comes from the .fam,
+/// L from the .bim next to it, and K, which a fileset does not hold, is 1.
+class MappedGenosMatrix
+{
+public:
+	static constexpr char MAGIC[8] = { 'V', 'B', 'G', 'E', 'N', 'O', 'S', '\0' };
+	static constexpr uint32_t VERSION = 2;
+	static constexpr int HEADER_BYTES = 64;
+	static constexpr int ROW_ALIGN = 8;
+	static constexpr int INDIVS_PER_BYTE = 4;
+
+	static constexpr uint32_t LAYOUT_LOCUS_MAJOR_2BIT = 1;
+
+	static constexpr unsigned char PLINK_MAGIC[3] = { 0x6c, 0x1b, 0x01 };
+	static constexpr int PLINK_HEADER_BYTES = 3;
+	static constexpr int MISSING_GENO = BitGenosMatrix::GENOTYPE_MASK;
+
+	MappedGenosMatrix();
+	~MappedGenosMatrix();
+
+	MappedGenosMatrix(const MappedGenosMatrix&) = delete;
+	MappedGenosMatrix& operator=(const MappedGenosMatrix&) = delete;
+
+	/// Maps the file at `path'. Returns false if it can not be mapped or is neither a packed genotype file
+	/// nor a PLINK .bed file with its .bim and .fam.
+	bool Open(const std::string& path);
+	void Close();
+
+	inline bool IsOpen() const { return data != nullptr; }
+	inline int GetNumIndivs() const { return num_indivs; }
+	inline int GetNumLoci() const { return num_loci; }
+	inline int GetNumClusters() const { return num_clusters; }
+	inline uint32_t GetVersion() const { return version; }
+	inline bool IsPlink() const { return is_plink; }
+
+	inline int GetGeno(int indiv, int locus) const
+	{
+		const unsigned char BYTE = GetLocusRow(locus)[indiv / INDIVS_PER_BYTE];
+		return geno_codes[(BYTE >> (indiv % INDIVS_PER_BYTE * BitGenosMatrix::BITS_PER_GENOTYPE)) & BitGenosMatrix::GENOTYPE_MASK];
+	}
+
+	/// Raw bytes of a locus, in the codes of the file.
+	inline const unsigned char* GetLocusRow(int locus) const
+	{
+		return data + header_bytes + static_cast<size_t>(bytes_per_locus) * locus;
+	}
+
+	/// Asks the OS to start reading loci [first_locus, last_locus) in the background.
+	void Prefetch(int first_locus, int last_locus) const;
+
+	/// Drops the pages of loci [first_locus, last_locus) from the resident set of the process.
+	/// The data stays valid; it is read again from the page cache or the file on the next access.
+	void Release(int first_locus, int last_locus) const;
+
+	/// Reads every locus and compares the checksum with the header. Always true for version 1 files.
+	bool Verify() const;
+
+	/// Copies the genotypes into `genos', a row at a time without parsing. PLINK codes are recoded a word at a time.
+	void CopyTo(BitGenosMatrix& genos) const;
+
+	/// Number of MISSING_GENO calls of the whole matrix.
+	int64_t CountMissing() const;
+
+	/// Number of MISSING_GENO calls at every locus and of every individual, a table lookup per byte.
+	void GetMissingCounts(std::vector<int>& locus_missing, std::vector<int>& indiv_missing) const;
+
+	/// True if the file at `path' starts with MAGIC or PLINK_MAGIC.
+	static bool IsMappedFile(const std::string& path);
+
+	/// Phenotypes of the .fam next to a PLINK .bed file: 1 control, 2 case, 0 or -9 unknown.
+	static bool ReadPlinkPhenotypes(const std::string& bed_path, std::vector<int>& phenotypes);
+
+	/// Writes `genos' to `path' in the packed layout.
+	static bool Write(const std::string& path, const BitGenosMatrix& genos);
+
+	/// FNV-1a hash of `num_bytes' bytes, continuing from `hash'.
+	static uint64_t GetChecksum(const unsigned char* bytes, size_t num_bytes, uint64_t hash = CHECKSUM_SEED);
+
+	static inline int GetBytesPerLocus(int num_indivs)
+	{
+		const int NUM_BYTES = (num_indivs + INDIVS_PER_BYTE - 1) / INDIVS_PER_BYTE;
+		return (NUM_BYTES + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+	}
+
+private:
+	static constexpr uint64_t CHECKSUM_SEED = 14695981039346656037ull;
+
+	bool Map(const std::string& path);
+	bool ReadHeader();
+	bool ReadPlinkHeader(const std::string& bed_path);
+	void Advise(int first_locus, int last_locus, bool will_need) const;
+
+	MappedFile file;
+	const unsigned char* data;
+	size_t num_bytes;
+	int header_bytes;
+	bool is_plink;
+	int geno_codes[BitGenosMatrix::GENOTYPE_MASK + 1];
+	uint32_t version;
+	uint64_t checksum;
+	int num_indivs;
+	int num_loci;
+	int num_clusters;
+	int bytes_per_locus;
+};
+
+#endif
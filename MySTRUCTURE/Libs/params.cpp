@@ -1,10 +1,14 @@
 #include "params.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <limits>
 #include <set>
 
 #include "logger.h"
+#include "text-genos.h"
+#include "thread-pool.h"
 
 #define MAX_INDIVS	4
 #define MAX_LOCI	6
@@ -138,34 +142,47 @@ void Params::AdjustAlleles()
 
 bool Params::Init(const char* input_path, bool is_labeled)
 {
-	std::ifstream input_file(input_path);
-	if (!input_file.is_open()) {
+	ThreadPool pool;
+	TextGenosFile input_file;
+	if (!input_file.Open(input_path, NUM_FIXED_PARAMS, pool)) {
 		logger << "Could not open input file '" << input_path << "'!" << std::endl;
 		return false;
 	}
 
-	ReadFixedParams(input_file);		// Read fixed parameters.
+	ReadFixedParams(input_file.GetHeader());		// Read fixed parameters.
 
-	// Read variable parameters.
+	// Read variable parameters, a row of alleles per chromosome with the label of the individual in front of it.
 	labels.clear();
 	labels.resize(GetNumIndividuals(), 0);
 	individuals.clear();
 	individuals.resize(GetNumIndividuals());
 	for (int i = 0; i < GetNumIndividuals(); ++i) {
 		individuals[i].resize(GetNumChromosomes());
-		for (int c = 0; c < GetNumChromosomes(); ++c) {
-			if (is_labeled) {
-				// Read label, for each chromosome and it is setted by the last chromosome.
-				char lbl;
-				input_file >> lbl;
-				SetLabel(i, lbl - '0');
-			}
-
-			// Read alleles of chromosome.
+		for (int c = 0; c < GetNumChromosomes(); ++c)
 			individuals[i][c].resize(GetNumLoci());
-			individuals[i].resize(GetNumChromosomes());
-			ReadAlleles(input_file, i, c);
-		}
+	}
+
+	const int NUM_ROWS = GetNumIndividuals() * GetNumChromosomes();
+	bool is_ok = true;
+	if (input_file.GetNumRows() == NUM_ROWS) {
+		// Rows are independent, the label is set by the last chromosome only, so no two rows write the same byte.
+		std::atomic<bool> is_rows_ok(true);
+		pool.ParallelFor(0, NUM_ROWS, [&](int first_row, int last_row) {
+			for (int r = first_row; r < last_row; ++r)
+				if (ReadAlleles(input_file.GetRowBegin(r), input_file.GetRowEnd(r), r / GetNumChromosomes(), r % GetNumChromosomes(),
+						is_labeled, r % GetNumChromosomes() == GetNumChromosomes() - 1) == nullptr)
+					is_rows_ok = false;
+		});
+		is_ok = is_rows_ok;
+	} else {
+		const char* pos = input_file.GetBodyBegin();
+		for (int r = 0; r < NUM_ROWS && pos != nullptr; ++r)
+			pos = ReadAlleles(pos, input_file.GetBodyEnd(), r / GetNumChromosomes(), r % GetNumChromosomes(), is_labeled, true);
+		is_ok = pos != nullptr;
+	}
+	if (!is_ok) {
+		logger << "Input file '" << input_path << "' has too few alleles!" << std::endl;
+		return false;
 	}
 
 	CollectGenotypeInfo();
@@ -173,21 +190,23 @@ bool Params::Init(const char* input_path, bool is_labeled)
 	return true;
 }
 
-void Params::ReadFixedParams(std::ifstream& input_file)
+void Params::ReadFixedParams(const std::vector<std::string>& header)
 {
-	input_file >> num_indivs;
-	input_file >> num_chromosomes;
-	input_file >> num_loci;
-	input_file >> num_clusters;
-	input_file >> num_iters;
-	input_file >> num_burnins;
+	num_indivs = atoi(header[0].c_str());
+	num_chromosomes = atoi(header[1].c_str());
+	num_loci = atoi(header[2].c_str());
+	num_clusters = atoi(header[3].c_str());
+	num_iters = atoi(header[4].c_str());
+	num_burnins = atoi(header[5].c_str());
 }
 
-void Params::ReadAlleles(std::ifstream& input_file, int i, int c)
+const char* Params::ReadAlleles(const char* pos, const char* end, int i, int c, bool is_labeled, bool is_label_set)
 {
-	for (int l = 0; l < GetNumLoci(); ++l) {
-		char allele;
-		input_file >> allele;
-		SetAllele(i, c, l, allele - '0');
-	}
+	const int OFFSET = is_labeled ? 1 : 0;
+	return TextGenosFile::ScanRow(pos, end, GetNumLoci() + OFFSET, [&](int l, char allele) {
+		if (l >= OFFSET)
+			SetAllele(i, c, l - OFFSET, allele - '0');
+		else if (is_label_set)
+			SetLabel(i, allele - '0');
+	});
 }
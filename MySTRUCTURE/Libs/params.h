@@ -2,6 +2,7 @@
 #define PARAMS_H_
 
 #include <fstream>
+#include <string>
 #include <vector>
 
 #define BASE_PATH					"E:\\C++\\MySTRUCTURE\\"
@@ -75,9 +76,15 @@ private:
 	void CollectGenotypeInfo();
 	void AdjustAlleles();
 
+	/// Number of integers in front of the alleles of an input file.
+	static constexpr int NUM_FIXED_PARAMS = 6;
+
 	bool Init(const char* input_path, bool is_labeled);
-	void ReadFixedParams(std::ifstream& input_file);
-	void ReadAlleles(std::ifstream& input_file, int i, int c);
+	void ReadFixedParams(const std::vector<std::string>& header);
+
+	/// Reads the optional label and the alleles of chromosome c of individual i from [pos, end);
+	/// the label is stored only if is_label_set. Returns the position after the last allele, nullptr if there are too few.
+	const char* ReadAlleles(const char* pos, const char* end, int i, int c, bool is_labeled, bool is_label_set);
 
 	/// Config parameters
 	int num_indivs;
@@ -0,0 +1,286 @@
+#include "simd-math.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Every backend provides a pack type with arithmetic operators and the same set of
+// helpers, so that the algorithms below are written once for scalars and vectors.
+
+struct ScalarPack
+{
+	typedef bool Mask;
+	static constexpr int LANES = 1;
+
+	ScalarPack() : v(0.0) {}
+	ScalarPack(double v) : v(v) {}
+
+	static inline ScalarPack Load(const double* p) { return ScalarPack(*p); }
+	inline void Store(double* p) const { *p = v; }
+
+	double v;
+};
+
+inline static ScalarPack operator+(ScalarPack a, ScalarPack b) { return a.v + b.v; }
+inline static ScalarPack operator-(ScalarPack a, ScalarPack b) { return a.v - b.v; }
+inline static ScalarPack operator*(ScalarPack a, ScalarPack b) { return a.v * b.v; }
+inline static ScalarPack operator/(ScalarPack a, ScalarPack b) { return a.v / b.v; }
+inline static bool Less(ScalarPack a, ScalarPack b) { return a.v < b.v; }
+inline static ScalarPack Select(bool m, ScalarPack a, ScalarPack b) { return m ? a : b; }
+inline static ScalarPack Round(ScalarPack a) { return std::nearbyint(a.v); }
+
+/// y * 2^n for an integral n in [-1022, 1023].
+inline static ScalarPack ScaleByPow2(ScalarPack y, ScalarPack n)
+{
+	const uint64_t BITS = static_cast<uint64_t>(static_cast<int64_t>(n.v) + 1023) << 52;
+	double pow2;
+	memcpy(&pow2, &BITS, sizeof(pow2));
+	return y.v * pow2;
+}
+
+/// x = mant * 2^expo with mant in [1, 2), x must be a positive normal number.
+inline static void SplitExponent(ScalarPack x, ScalarPack& mant, ScalarPack& expo)
+{
+	uint64_t bits;
+	memcpy(&bits, &x.v, sizeof(bits));
+	expo = static_cast<double>(static_cast<int>((bits >> 52) & 0x7FF) - 1023);
+	bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+	memcpy(&mant.v, &bits, sizeof(bits));
+}
+
+#if defined(__AVX512F__)
+
+struct VectorPack
+{
+	typedef __mmask8 Mask;
+	static constexpr int LANES = 8;
+
+	VectorPack() : v(_mm512_setzero_pd()) {}
+	VectorPack(double d) : v(_mm512_set1_pd(d)) {}
+	VectorPack(__m512d v) : v(v) {}
+
+	static inline VectorPack Load(const double* p) { return _mm512_loadu_pd(p); }
+	inline void Store(double* p) const { _mm512_storeu_pd(p, v); }
+
+	__m512d v;
+};
+
+inline static VectorPack operator+(VectorPack a, VectorPack b) { return _mm512_add_pd(a.v, b.v); }
+inline static VectorPack operator-(VectorPack a, VectorPack b) { return _mm512_sub_pd(a.v, b.v); }
+inline static VectorPack operator*(VectorPack a, VectorPack b) { return _mm512_mul_pd(a.v, b.v); }
+inline static VectorPack operator/(VectorPack a, VectorPack b) { return _mm512_div_pd(a.v, b.v); }
+inline static __mmask8 Less(VectorPack a, VectorPack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+inline static VectorPack Select(__mmask8 m, VectorPack a, VectorPack b) { return _mm512_mask_blend_pd(m, b.v, a.v); }
+
+// The unmasked forms of the intrinsics below pass an undefined source to their masked builtin, which GCC
+// reports as maybe uninitialized; the masked forms with every lane set and a defined source are the same instruction.
+static constexpr __mmask8 ALL_LANES = 0xFF;
+
+inline static VectorPack Round(VectorPack a)
+{
+	return _mm512_mask_roundscale_pd(a.v, ALL_LANES, a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+
+inline static VectorPack ScaleByPow2(VectorPack y, VectorPack n) { return _mm512_mask_scalef_pd(y.v, ALL_LANES, y.v, n.v); }
+
+inline static void SplitExponent(VectorPack x, VectorPack& mant, VectorPack& expo)
+{
+	expo = _mm512_mask_getexp_pd(x.v, ALL_LANES, x.v);
+	mant = _mm512_mask_getmant_pd(x.v, ALL_LANES, x.v, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+}
+
+#elif defined(__AVX2__)
+
+struct VectorPack
+{
+	typedef __m256d Mask;
+	static constexpr int LANES = 4;
+
+	VectorPack() : v(_mm256_setzero_pd()) {}
+	VectorPack(double d) : v(_mm256_set1_pd(d)) {}
+	VectorPack(__m256d v) : v(v) {}
+
+	static inline VectorPack Load(const double* p) { return _mm256_loadu_pd(p); }
+	inline void Store(double* p) const { _mm256_storeu_pd(p, v); }
+
+	__m256d v;
+};
+
+inline static VectorPack operator+(VectorPack a, VectorPack b) { return _mm256_add_pd(a.v, b.v); }
+inline static VectorPack operator-(VectorPack a, VectorPack b) { return _mm256_sub_pd(a.v, b.v); }
+inline static VectorPack operator*(VectorPack a, VectorPack b) { return _mm256_mul_pd(a.v, b.v); }
+inline static VectorPack operator/(VectorPack a, VectorPack b) { return _mm256_div_pd(a.v, b.v); }
+inline static __m256d Less(VectorPack a, VectorPack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+inline static VectorPack Select(__m256d m, VectorPack a, VectorPack b) { return _mm256_blendv_pd(b.v, a.v, m); }
+inline static VectorPack Round(VectorPack a) { return _mm256_round_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+inline static VectorPack ScaleByPow2(VectorPack y, VectorPack n)
+{
+	// Adding 2^52 + 1023 moves the biased exponent into the low mantissa bits.
+	const __m256d BIASED = _mm256_add_pd(n.v, _mm256_set1_pd(4503599627370496.0 + 1023.0));
+	const __m256i BITS = _mm256_slli_epi64(_mm256_castpd_si256(BIASED), 52);
+	return _mm256_mul_pd(y.v, _mm256_castsi256_pd(BITS));
+}
+
+inline static void SplitExponent(VectorPack x, VectorPack& mant, VectorPack& expo)
+{
+	const __m256i BITS = _mm256_castpd_si256(x.v);
+	const __m256i MANT_BITS = _mm256_or_si256(_mm256_and_si256(BITS, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+			_mm256_set1_epi64x(0x3FF0000000000000LL));
+	mant = _mm256_castsi256_pd(MANT_BITS);
+
+	// Biased exponent as the low mantissa bits of 2^52, then subtract 2^52 + 1023.
+	const __m256i EXPO_BITS = _mm256_or_si256(_mm256_srli_epi64(BITS, 52), _mm256_set1_epi64x(0x4330000000000000LL));
+	expo = _mm256_sub_pd(_mm256_castsi256_pd(EXPO_BITS), _mm256_set1_pd(4503599627370496.0 + 1023.0));
+}
+
+#else
+
+typedef ScalarPack VectorPack;
+
+#endif
+
+
+
+template <typename T>
+inline static T Exp(T x)
+{
+	// Cephes exp: exp(x) = 2^n * exp(r), |r| <= ln(2) / 2, with a Pade form for exp(r).
+	static constexpr double MIN_X = -708.0;
+	static constexpr double MAX_X = 709.0;
+	const T CLAMPED = Select(Less(x, T(MIN_X)), T(MIN_X), Select(Less(T(MAX_X), x), T(MAX_X), x));
+
+	const T N = Round(CLAMPED * T(1.4426950408889634073599));
+	const T R = CLAMPED - N * T(6.93145751953125E-1) - N * T(1.42860682030941723212E-6);
+	const T RR = R * R;
+	const T PX = R * ((RR * T(1.26177193074810590878E-4) + T(3.02994407707441961300E-2)) * RR + T(9.99999999999999999910E-1));
+	const T QX = ((RR * T(3.00198505138664455042E-6) + T(2.52448340349684104192E-3)) * RR
+			+ T(2.27265548208155028766E-1)) * RR + T(2.00000000000000000009E0);
+	const T EXP_R = T(1.0) + T(2.0) * PX / (QX - PX);
+	const T RES = ScaleByPow2(EXP_R, N);
+	return Select(Less(x, T(MIN_X)), T(0.0), Select(Less(T(MAX_X), x), T(HUGE_VAL), RES));
+}
+
+template <typename T>
+inline static T Log(T x)
+{
+	// Cephes log: x = m * 2^e with m in [sqrt(1/2), sqrt(2)), log(1 + f) = f - f^2/2 + f^3 P(f) / Q(f).
+	T mant, expo;
+	SplitExponent(x, mant, expo);
+	const auto IS_BIG = Less(T(1.41421356237309504880), mant);
+	mant = Select(IS_BIG, mant * T(0.5), mant);
+	expo = Select(IS_BIG, expo + T(1.0), expo);
+
+	const T F = mant - T(1.0);
+	const T FF = F * F;
+	const T P = ((((F * T(1.01875663804580931796E-4) + T(4.97494994976747001425E-1)) * F
+			+ T(4.70579119878881725854E0)) * F + T(1.44989225341610930846E1)) * F
+			+ T(1.79368678507819816313E1)) * F + T(7.70838733755885391666E0);
+	const T Q = ((((F + T(1.12873587189167450590E1)) * F + T(4.52279145837532221105E1)) * F
+			+ T(8.29875266912776603211E1)) * F + T(7.11544750618563894466E1)) * F + T(2.31251620126765340583E1);
+
+	T y = F * (FF * P / Q) - expo * T(2.121944400546905827679E-4) - T(0.5) * FF;
+	return F + y + expo * T(0.693359375);
+}
+
+template <typename T>
+inline static T Digamma(T x)
+{
+	// psi(x) = psi(x + 1) - 1 / x until x >= 10, the shifts are summed as one fraction.
+	T num(0.0), den(1.0);
+	for (int i = 0; i < 10; ++i) {
+		const auto IS_SMALL = Less(x, T(10.0));
+		num = Select(IS_SMALL, num * x + den, num);
+		den = Select(IS_SMALL, den * x, den);
+		x = Select(IS_SMALL, x + T(1.0), x);
+	}
+
+	// Asymptotic series, the first omitted term is below 5e-17 for x >= 10.
+	const T INV = T(1.0) / x;
+	const T INV2 = INV * INV;
+	const T SERIES = INV2 * (T(1.0 / 12.0) - INV2 * (T(1.0 / 120.0) - INV2 * (T(1.0 / 252.0) - INV2 * (T(1.0 / 240.0)
+			- INV2 * (T(1.0 / 132.0) - INV2 * (T(691.0 / 32760.0) - INV2 * T(1.0 / 12.0)))))));
+	return Log(x) - T(0.5) * INV - SERIES - num / den;
+}
+
+template <typename T>
+inline static T LogGamma(T x)
+{
+	// log(Gamma(x)) = log(Gamma(x + 1)) - log(x) until x >= 10, the shifts are multiplied first.
+	T prod(1.0);
+	for (int i = 0; i < 10; ++i) {
+		const auto IS_SMALL = Less(x, T(10.0));
+		prod = Select(IS_SMALL, prod * x, prod);
+		x = Select(IS_SMALL, x + T(1.0), x);
+	}
+
+	// Stirling series, the first omitted term is below 3e-17 for x >= 10.
+	static constexpr double HALF_LOG_2PI = 0.91893853320467274178;
+	const T INV = T(1.0) / x;
+	const T INV2 = INV * INV;
+	const T SERIES = INV * (T(1.0 / 12.0) - INV2 * (T(1.0 / 360.0) - INV2 * (T(1.0 / 1260.0) - INV2 * (T(1.0 / 1680.0)
+			- INV2 * (T(1.0 / 1188.0) - INV2 * (T(691.0 / 360360.0) - INV2 * T(1.0 / 156.0)))))));
+	return (x - T(0.5)) * Log(x) - x + T(HALF_LOG_2PI) + SERIES - Log(prod);
+}
+
+template <typename Func>
+inline static void ApplyArray(const double* x, double* out, int n, Func func)
+{
+	int i = 0;
+	for (; i + VectorPack::LANES <= n; i += VectorPack::LANES)
+		func(VectorPack::Load(x + i)).Store(out + i);
+	for (; i < n; ++i)
+		func(ScalarPack::Load(x + i)).Store(out + i);
+}
+
+
+
+int GetSimdLanes()
+{
+	return VectorPack::LANES;
+}
+
+const char* GetSimdInstructionSet()
+{
+#if defined(__AVX512F__)
+	return "AVX-512";
+#elif defined(__AVX2__)
+	return "AVX2";
+#else
+	return "Scalar";
+#endif
+}
+
+double Digamma(double x)
+{
+	return Digamma(ScalarPack(x)).v;
+}
+
+double LogGamma(double x)
+{
+	return LogGamma(ScalarPack(x)).v;
+}
+
+void ExpArray(const double* x, double* out, int n)
+{
+	ApplyArray(x, out, n, [](auto v) { return Exp(v); });
+}
+
+void LogArray(const double* x, double* out, int n)
+{
+	ApplyArray(x, out, n, [](auto v) { return Log(v); });
+}
+
+void DigammaArray(const double* x, double* out, int n)
+{
+	ApplyArray(x, out, n, [](auto v) { return Digamma(v); });
+}
+
+void LogGammaArray(const double* x, double* out, int n)
+{
+	ApplyArray(x, out, n, [](auto v) { return LogGamma(v); });
+}
@@ -0,0 +1,36 @@
+#ifndef SIMD_MATH_H_
+#define SIMD_MATH_H_
+
+/// Vectorized exp, log, digamma and log-gamma for the VB updates.
+///
+/// The array kernels process GetSimdLanes() doubles at once: 8 with AVX-512, 4 with AVX2.
+/// The tail of an array, and every call on other targets, runs the same algorithm on
+/// scalars, so results do not depend on the alignment or the length of the arrays as long as
+/// simd-math.cpp is built with -ffp-contract=off (/fp:precise with MSVC). Otherwise the compiler
+/// fuses a * b + c into FMAs differently in the two paths and the tail elements may differ in the last bits.
+/// Build with -mavx2 -mfma, -mavx512f or -march=native to enable the vector paths.
+///
+/// Maximum errors against long double references (expl, logl, lgammal, and the recurrence and series for
+/// Digamma) over 10^8 random arguments, log-uniform over the range and uniform over the intervals where
+/// the error peaks, built with -O3 -march=native -ffp-contract=off. The AVX-512, AVX2 and scalar builds
+/// give the same results.
+///   Exp       x in [-708, 709]    2 ulp       (0 below -708, +inf above 709)
+///   Log       x normal, x > 0     1 ulp
+///   Digamma   x in [1e-8, 1e8]    36 ulp      outside [1, 3], where the root 1.4616 is and
+///                                             the absolute error is below 3e-15 instead
+///   LogGamma  x in [1e-8, 1e8]    38 ulp      outside [0.2, 4], where the roots 1 and 2 are
+///                                             and the absolute error is below 1e-14 instead
+/// Digamma and LogGamma are only defined for x > 0.
+
+int GetSimdLanes();
+const char* GetSimdInstructionSet();
+
+double Digamma(double x);
+double LogGamma(double x);
+
+void ExpArray(const double* x, double* out, int n);
+void LogArray(const double* x, double* out, int n);
+void DigammaArray(const double* x, double* out, int n);
+void LogGammaArray(const double* x, double* out, int n);
+
+#endif
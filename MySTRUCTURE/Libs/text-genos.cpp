@@ -0,0 +1,253 @@
+#include "text-genos.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include "thread-pool.h"
+
+namespace
+{
+
+/// Lines are split into chunks of at least this many bytes, a few per thread.
+constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+constexpr int CHUNKS_PER_THREAD = 4;
+
+/// Genotype codes of the -faststr.txt characters, WHITESPACE for the separators.
+constexpr unsigned char WHITESPACE = 1 << BitGenosMatrix::BITS_PER_GENOTYPE;
+
+struct GenoCodes
+{
+	GenoCodes()
+	{
+		for (int c = 0; c < 256; ++c)
+			codes[c] = c <= ' ' ? WHITESPACE : static_cast<unsigned char>(TextGenosFile::GetGeno(static_cast<char>(c)));
+	}
+
+	unsigned char codes[256];
+};
+
+const GenoCodes GENO_CODES;
+
+typedef BitGenosMatrix::GenotypeMatrixType Word;
+
+/// Loci packed per step, one byte of a word each, and words of a locus row per task, a cache line.
+constexpr int LOCI_PER_STEP = sizeof(Word);
+constexpr int WORDS_PER_TILE = 64 / sizeof(Word);
+
+/// Codes of the LOCI_PER_STEP characters at `pos', one per byte. '0' .. '3' are their codes after
+/// an xor, so the table is needed only for blocks with other characters. Assumes a little endian word.
+inline Word LoadCodes(const char* pos, unsigned char& all_codes)
+{
+	static constexpr Word ZEROS = ~static_cast<Word>(0) / 0xFF * '0';
+	static constexpr Word HIGH_BITS = ~static_cast<Word>(0) / 0xFF * 0xFC;
+	Word codes;
+	memcpy(&codes, pos, sizeof(codes));
+	codes ^= ZEROS;
+	if ((codes & HIGH_BITS) == 0)
+		return codes;
+
+	codes = 0;
+	for (int b = 0; b < LOCI_PER_STEP; ++b) {
+		const unsigned char CODE = GENO_CODES.codes[static_cast<unsigned char>(pos[b])];
+		all_codes |= CODE;
+		codes |= static_cast<Word>(CODE & BitGenosMatrix::GENOTYPE_MASK) << (b * CHAR_BIT);
+	}
+	return codes;
+}
+
+/// Packs loci [l, l + LOCI_PER_STEP) of `num_rows' <= INDIVS_PER_WORD rows into one word per locus.
+/// Byte g of a word holds rows 4 g .. 4 g + 3, so the codes of 4 rows are merged into bytes of
+/// one word per g, and the 8 x 8 byte matrix of these words is transposed into the locus words.
+inline void PackStep(const char* const* rows, int num_rows, int l, Word* words, unsigned char& all_codes)
+{
+	static constexpr int ROWS_PER_BYTE = CHAR_BIT / BitGenosMatrix::BITS_PER_GENOTYPE;
+	Word m[LOCI_PER_STEP];
+	for (int g = 0; g < LOCI_PER_STEP; ++g) {
+		m[g] = 0;
+		for (int r = 0; r < ROWS_PER_BYTE && g * ROWS_PER_BYTE + r < num_rows; ++r)
+			m[g] |= LoadCodes(rows[g * ROWS_PER_BYTE + r] + l, all_codes) << (r * BitGenosMatrix::BITS_PER_GENOTYPE);
+	}
+
+	// Swap the off-diagonal blocks of 4 x 4, 2 x 2 and 1 x 1 bytes.
+	for (int g = 0; g < 4; ++g) {
+		const Word T = ((m[g] >> 32) ^ m[g + 4]) & 0x00000000FFFFFFFFull;
+		m[g] ^= T << 32;
+		m[g + 4] ^= T;
+	}
+	for (int g : { 0, 1, 4, 5 }) {
+		const Word T = ((m[g] >> 16) ^ m[g + 2]) & 0x0000FFFF0000FFFFull;
+		m[g] ^= T << 16;
+		m[g + 2] ^= T;
+	}
+	for (int g = 0; g < LOCI_PER_STEP; g += 2) {
+		const Word T = ((m[g] >> 8) ^ m[g + 1]) & 0x00FF00FF00FF00FFull;
+		m[g] ^= T << 8;
+		m[g + 1] ^= T;
+	}
+	for (int k = 0; k < LOCI_PER_STEP; ++k)
+		words[k] = m[k];
+}
+
+inline bool IsSpace(char c) { return static_cast<unsigned char>(c) <= ' '; }
+
+/// Integer header token, false if it is not a whole number.
+bool ParseInt(const std::string& token, int& val)
+{
+	char* end = nullptr;
+	const long VAL = strtol(token.c_str(), &end, 10);
+	val = static_cast<int>(VAL);
+	return !token.empty() && *end == '\0';
+}
+
+}
+
+bool TextGenosFile::Open(const std::string& path, int num_header_tokens, ThreadPool& pool)
+{
+	Close();
+	if (!file.Open(path))
+		return false;
+	file.Advise(0, file.GetSize(), true);
+
+	const char* pos = reinterpret_cast<const char*>(file.GetData());
+	const char* END = GetBodyEnd();
+	for (int t = 0; t < num_header_tokens; ++t) {
+		while (pos != END && IsSpace(*pos))
+			++pos;
+		const char* TOKEN = pos;
+		while (pos != END && !IsSpace(*pos))
+			++pos;
+		if (TOKEN == pos) {
+			Close();
+			return false;
+		}
+		header.emplace_back(TOKEN, pos);
+	}
+
+	// Rows start on the line after the header.
+	if (num_header_tokens > 0) {
+		const void* NEW_LINE = memchr(pos, '\n', END - pos);
+		pos = NEW_LINE != nullptr ? static_cast<const char*>(NEW_LINE) + 1 : END;
+	}
+	body = pos;
+	FindRows(pool);
+	return true;
+}
+
+void TextGenosFile::Close()
+{
+	file.Close();
+	header.clear();
+	body = nullptr;
+	rows.clear();
+}
+
+void TextGenosFile::FindRows(ThreadPool& pool)
+{
+	const char* END = GetBodyEnd();
+	const size_t NUM_BYTES = END - body;
+	const int NUM_CHUNKS = static_cast<int>(std::max<size_t>(1,
+		std::min<size_t>(static_cast<size_t>(pool.GetNumThreads()) * CHUNKS_PER_THREAD, NUM_BYTES / MIN_CHUNK_BYTES)));
+
+	std::vector<std::vector<Row>> chunk_rows(NUM_CHUNKS);
+	pool.ParallelFor(0, NUM_CHUNKS, [&](int first_chunk, int last_chunk) {
+		for (int c = first_chunk; c < last_chunk; ++c) {
+			// A line belongs to the chunk holding its first byte.
+			const char* pos = body + NUM_BYTES * c / NUM_CHUNKS;
+			const char* CHUNK_END = body + NUM_BYTES * (c + 1) / NUM_CHUNKS;
+			if (pos != body && pos[-1] != '\n') {
+				const void* NEW_LINE = memchr(pos, '\n', END - pos);
+				pos = NEW_LINE != nullptr ? static_cast<const char*>(NEW_LINE) + 1 : END;
+			}
+			while (pos < CHUNK_END) {
+				const void* NEW_LINE = memchr(pos, '\n', END - pos);
+				const char* LINE_END = NEW_LINE != nullptr ? static_cast<const char*>(NEW_LINE) : END;
+				Row row = { pos, LINE_END };
+				while (row.begin != row.end && IsSpace(*row.begin))
+					++row.begin;
+				while (row.end != row.begin && IsSpace(row.end[-1]))
+					--row.end;
+				if (row.begin != row.end)
+					chunk_rows[c].push_back(row);
+				pos = LINE_END == END ? END : LINE_END + 1;
+			}
+		}
+	});
+
+	size_t num_rows = 0;
+	for (const auto& chunk : chunk_rows)
+		num_rows += chunk.size();
+	rows.reserve(num_rows);
+	for (const auto& chunk : chunk_rows)
+		rows.insert(rows.end(), chunk.begin(), chunk.end());
+}
+
+bool TextGenosFile::ReadFastStructure(const std::string& path, BitGenosMatrix& genos, ThreadPool& pool)
+{
+	TextGenosFile text;
+	int num_indivs = 0, num_loci = 0, num_clusters = 0;
+	if (!text.Open(path, 6, pool) || !ParseInt(text.GetHeader()[1], num_indivs) || !ParseInt(text.GetHeader()[3], num_loci)
+			|| !ParseInt(text.GetHeader()[5], num_clusters) || num_indivs < 0 || num_loci < 0 || num_clusters < 1)
+		return false;
+
+	genos.Init(num_indivs, num_loci, num_clusters);
+	const int NUM_INDIVS = genos.GetNumIndivs();
+	const int NUM_LOCI = genos.GetNumLoci();
+	if (text.GetNumRows() != NUM_INDIVS) {
+		const char* pos = text.GetBodyBegin();
+		for (int i = 0; i < NUM_INDIVS && pos != nullptr; ++i)
+			pos = ScanRow(pos, text.GetBodyEnd(), NUM_LOCI, [&](int l, char c) { genos.SetGeno(i, l, GetGeno(c)); });
+		return pos != nullptr;
+	}
+
+	// A task owns WORDS_PER_TILE words of every locus row, the rows of INDIVS_PER_WORD * WORDS_PER_TILE
+	// individuals, so a locus step fills a cache line of each row and no two tasks write the same word.
+	// Rows of exactly L characters have no whitespace inside and are packed LOCI_PER_STEP loci at a time.
+	static constexpr int INDIVS_PER_WORD = BitGenosMatrix::INDIVS_PER_WORD;
+	const int NUM_WORDS = (NUM_INDIVS + INDIVS_PER_WORD - 1) / INDIVS_PER_WORD;
+	std::atomic<bool> is_ok(true);
+	pool.ParallelFor(0, (NUM_WORDS + WORDS_PER_TILE - 1) / WORDS_PER_TILE, [&](int first_tile, int last_tile) {
+		const char* row_begins[INDIVS_PER_WORD * WORDS_PER_TILE];
+		for (int t = first_tile; t < last_tile; ++t) {
+			const int FIRST_WORD = t * WORDS_PER_TILE;
+			const int LAST_WORD = std::min(FIRST_WORD + WORDS_PER_TILE, NUM_WORDS);
+			const int FIRST_INDIV = FIRST_WORD * INDIVS_PER_WORD;
+			const int LAST_INDIV = std::min(LAST_WORD * INDIVS_PER_WORD, NUM_INDIVS);
+			bool is_plain = true;
+			for (int i = FIRST_INDIV; i < LAST_INDIV; ++i)
+				is_plain = is_plain && text.GetRowEnd(i) - text.GetRowBegin(i) == NUM_LOCI;
+
+			if (!is_plain) {
+				for (int i = FIRST_INDIV; i < LAST_INDIV; ++i)
+					if (ScanRow(text.GetRowBegin(i), text.GetRowEnd(i), NUM_LOCI, [&](int l, char c) { genos.SetGeno(i, l, GetGeno(c)); }) == nullptr)
+						is_ok = false;
+				continue;
+			}
+
+			for (int i = FIRST_INDIV; i < LAST_INDIV; ++i)
+				row_begins[i - FIRST_INDIV] = text.GetRowBegin(i);
+			unsigned char all_codes = 0;
+			int l = 0;
+			for (; l + LOCI_PER_STEP <= NUM_LOCI; l += LOCI_PER_STEP)
+				for (int w = FIRST_WORD; w < LAST_WORD; ++w) {
+					Word words[LOCI_PER_STEP];
+					PackStep(row_begins + (w - FIRST_WORD) * INDIVS_PER_WORD,
+						std::min(INDIVS_PER_WORD, NUM_INDIVS - w * INDIVS_PER_WORD), l, words, all_codes);
+					for (int k = 0; k < LOCI_PER_STEP; ++k)
+						genos.GetLocusRow(l + k)[w] = words[k];
+				}
+			for (; l < NUM_LOCI; ++l)
+				for (int i = FIRST_INDIV; i < LAST_INDIV; ++i) {
+					const unsigned char CODE = GENO_CODES.codes[static_cast<unsigned char>(row_begins[i - FIRST_INDIV][l])];
+					all_codes |= CODE;
+					genos.SetGeno(i, l, CODE & BitGenosMatrix::GENOTYPE_MASK);
+				}
+			// A separator inside a row of L characters leaves it short of genotypes.
+			if (all_codes & WHITESPACE)
+				is_ok = false;
+		}
+	});
+	return is_ok;
+}
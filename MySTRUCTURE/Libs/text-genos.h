@@ -0,0 +1,78 @@
+#ifndef TEXT_GENOS_H_
+#define TEXT_GENOS_H_
+
+#include <string>
+#include <vector>
+
+#include "bit_genos_matrix.h"
+#include "mapped-file.h"
+
+class ThreadPool;
+
+/// Loader of the text genotype files, rows of single character genotypes after a header of
+/// whitespace separated tokens:
+///   -faststr.txt   NUM_INDIVS: N  NUM_LOCI: L  NUM_CLUSTERS: K, then N K rows of L genotypes
+///   MySTRUCTURE    six integers, then one row of an optional label and L alleles per chromosome
+/// The file is mapped and cut into one chunk of bytes per task; every task collects the lines that
+/// start in its chunk, so the rows are found, and then decoded, on all cores without copying the text.
+/// A file whose lines are not the rows, e.g. a row wrapped over several lines, is decoded as one
+/// stream of genotypes in the calling thread.
+class TextGenosFile
+{
+public:
+	TextGenosFile() : body(nullptr) {}
+
+	/// Maps `path', reads `num_header_tokens' tokens and indexes the non-empty lines after the line of the last one.
+	bool Open(const std::string& path, int num_header_tokens, ThreadPool& pool);
+	void Close();
+
+	inline const std::vector<std::string>& GetHeader() const { return header; }
+	inline int GetNumRows() const { return static_cast<int>(rows.size()); }
+
+	/// Row without its leading and trailing whitespace.
+	inline const char* GetRowBegin(int row) const { return rows[row].begin; }
+	inline const char* GetRowEnd(int row) const { return rows[row].end; }
+
+	/// Text after the header, for decoding it as one stream.
+	inline const char* GetBodyBegin() const { return body; }
+	inline const char* GetBodyEnd() const { return reinterpret_cast<const char*>(file.GetData()) + file.GetSize(); }
+
+	/// Calls func(i, c) for the first `num' characters c of [pos, end) that are not whitespace.
+	/// Returns the position after the last one, nullptr if there are fewer than `num'.
+	template <typename Func>
+	static inline const char* ScanRow(const char* pos, const char* end, int num, Func func)
+	{
+		for (int i = 0; i < num; ++i) {
+			while (pos != end && static_cast<unsigned char>(*pos) <= ' ')
+				++pos;
+			if (pos == end)
+				return nullptr;
+			func(i, *pos++);
+		}
+		return pos;
+	}
+
+	/// Genotype of a -faststr.txt character: '0', '1' and '2' are themselves, every other character
+	/// ('9', '-', 'N', ...) is a missing call.
+	static inline int GetGeno(char c) { return c >= '0' && c <= '2' ? c - '0' : BitGenosMatrix::MISSING_GENO; }
+
+	/// Reads a -faststr.txt file into `genos', the rows of whole packed words per task, so every word is
+	/// written by one task. Returns false if the file can not be read, has a bad header or too few genotypes.
+	static bool ReadFastStructure(const std::string& path, BitGenosMatrix& genos, ThreadPool& pool);
+
+private:
+	struct Row
+	{
+		const char* begin;
+		const char* end;
+	};
+
+	void FindRows(ThreadPool& pool);
+
+	MappedFile file;
+	std::vector<std::string> header;
+	const char* body;
+	std::vector<Row> rows;
+};
+
+#endif
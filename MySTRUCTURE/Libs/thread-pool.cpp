@@ -0,0 +1,112 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads)
+	: num_threads(num_threads > 0 ? num_threads : GetHardwareThreads())
+	, task(nullptr)
+	, task_begin(0)
+	, task_end(0)
+	, num_pending(0)
+	, generation(0)
+	, is_stopping(false)
+{
+	// Thread #0 is the caller of ParallelFor.
+	for (int t = 1; t < GetNumThreads(); ++t)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, t);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		is_stopping = true;
+	}
+	start_cv.notify_all();
+	for (auto& w : workers)
+		w.join();
+}
+
+int ThreadPool::GetHardwareThreads()
+{
+	const int NUM_HW_THREADS = static_cast<int>(std::thread::hardware_concurrency());
+	return std::max(1, NUM_HW_THREADS);
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const RangeFunc& func)
+{
+	if (end <= begin)
+		return;
+
+	if (GetNumThreads() == 1 || end - begin == 1) {
+		func(begin, end);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		task = &func;
+		task_begin = begin;
+		task_end = end;
+		num_pending = GetNumThreads() - 1;
+		++generation;
+	}
+	start_cv.notify_all();
+
+	RunChunk(0);
+
+	std::unique_lock<std::mutex> lock(mtx);
+	done_cv.wait(lock, [this] { return num_pending == 0; });
+	task = nullptr;
+}
+
+double ThreadPool::ParallelSum(int begin, int end, int block_size, const SumFunc& func)
+{
+	if (end <= begin)
+		return 0.0;
+
+	const int NUM_BLOCKS = (end - begin + block_size - 1) / block_size;
+	std::vector<double> partials(NUM_BLOCKS, 0.0);
+	ParallelFor(0, NUM_BLOCKS, [&](int first_block, int last_block) {
+		for (int b = first_block; b < last_block; ++b) {
+			const int FIRST = begin + b * block_size;
+			const int LAST = std::min(end, FIRST + block_size);
+			partials[b] = func(FIRST, LAST);
+		}
+	});
+
+	double sm = 0.0;
+	for (const double p : partials)
+		sm += p;
+	return sm;
+}
+
+void ThreadPool::WorkerLoop(int thread_idx)
+{
+	unsigned last_generation = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			start_cv.wait(lock, [&] { return is_stopping || generation != last_generation; });
+			if (is_stopping)
+				return;
+			last_generation = generation;
+		}
+
+		RunChunk(thread_idx);
+
+		std::lock_guard<std::mutex> lock(mtx);
+		if (--num_pending == 0)
+			done_cv.notify_one();
+	}
+}
+
+void ThreadPool::RunChunk(int thread_idx)
+{
+	// Static contiguous partitioning keeps each element on the same chunk boundaries as the serial loop.
+	const long long NUM_ELEMS = task_end - task_begin;
+	const int FIRST = task_begin + static_cast<int>(NUM_ELEMS * thread_idx / GetNumThreads());
+	const int LAST = task_begin + static_cast<int>(NUM_ELEMS * (thread_idx + 1) / GetNumThreads());
+	if (FIRST < LAST)
+		(*task)(FIRST, LAST);
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed size pool of worker threads for data parallel loops.
+/// A range is split into one contiguous chunk per thread, so every element is
+/// processed by exactly one thread and in the same order as the serial loop.
+class ThreadPool
+{
+public:
+	typedef std::function<void(int first, int last)> RangeFunc;
+	typedef std::function<double(int first, int last)> SumFunc;
+
+	/// Zero or negative number of threads means all hardware threads.
+	explicit ThreadPool(int num_threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	inline int GetNumThreads() const { return num_threads; }
+
+	/// Calls func(first, last) on sub-ranges of [begin, end) and waits for all of them.
+	/// The calling thread runs the first chunk. Must not be called from inside func.
+	void ParallelFor(int begin, int end, const RangeFunc& func);
+
+	/// Sums func(first, last) over fixed blocks of `block_size' elements.
+	/// Blocks do not depend on the number of threads and partial sums are added
+	/// in block order, so the result is bit-identical for any thread count.
+	double ParallelSum(int begin, int end, int block_size, const SumFunc& func);
+
+	static int GetHardwareThreads();
+
+private:
+	void WorkerLoop(int thread_idx);
+	void RunChunk(int thread_idx);
+
+	int num_threads;
+	std::vector<std::thread> workers;
+
+	std::mutex mtx;
+	std::condition_variable start_cv;
+	std::condition_variable done_cv;
+	const RangeFunc* task;
+	int task_begin;
+	int task_end;
+	int num_pending;
+	unsigned generation;
+	bool is_stopping;
+};
+
+#endif
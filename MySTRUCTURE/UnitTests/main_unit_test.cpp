@@ -1,9 +1,22 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
 #include <sstream>
 
 #include "bit_genos_matrix.h"
+#include "cluster-matching.h"
 #include "dists.h"
+#include "file-writer.h"
 #include "logger.h"
+#include "mapped-genos.h"
 #include "params.h"
+#include "simd-math.h"
+#include "text-genos.h"
+#include "thread-pool.h"
 
 
 
@@ -145,10 +158,430 @@ static void TestGenosMatrix()
 		logger << "Some thing is going worng!" << std::endl;
 }
 
+static void TestGenosLocusClasses()
+{
+	// 3 clusters of 12 individuals, so the packed rows span two words of INDIVS_PER_WORD (32) individuals.
+	// The classes of locus 3 change inside the first word and the class of genotype 1 goes on into the second.
+	BitGenosMatrix genos(12, 4, 3);
+	for (int i = 0; i < genos.GetNumIndivs(); ++i) {
+		genos.SetGeno(i, 0, i % 3);
+		genos.SetGeno(i, 1, (i * 7 + 1) % 3);
+		genos.SetGeno(i, 2, 2);
+		genos.SetGeno(i, 3, i < 30 ? 0 : 1);
+	}
+
+	bool is_ok = true;
+	BitGenosMatrix::LocusClasses classes;
+	for (int l = 0; l < genos.GetNumLoci(); ++l) {
+		genos.GetLocusClasses(l, classes);
+		int num_indivs = 0;
+		for (int g = 0; g < BitGenosMatrix::NUM_GENOTYPES; ++g) {
+			int last_indiv = -1;
+			for (const int* n = classes.Begin(g); n != classes.End(g); ++n) {
+				if (genos.GetGeno(*n, l) != g || *n <= last_indiv)
+					is_ok = false;
+				last_indiv = *n;
+			}
+			num_indivs += classes.GetCount(g);
+			logger << classes.GetCount(g) << ' ';
+		}
+		logger << (classes.IsMonomorphic() ? "monomorphic" : "") << std::endl;
+
+		if (num_indivs != genos.GetNumIndivs() || classes.IsMonomorphic() != (l == 2))
+			is_ok = false;
+	}
+
+	if (is_ok)
+		logger << "Every thing is OK!" << std::endl;
+	else
+		logger << "Some thing is going worng!" << std::endl;
+}
+
+static void TestPackedGenosRows()
+{
+	// 3 clusters of 25 individuals: 3 words per row, padded to ROW_ALIGN_WORDS.
+	BitGenosMatrix genos(25, 11, 3);
+	for (int i = 0; i < genos.GetNumIndivs(); ++i)
+		for (int l = 0; l < genos.GetNumLoci(); ++l)
+			genos.SetGeno(i, l, l == 4 ? 1 : (i * 7 + l * 5 + i * l) % 3);
+
+	bool is_ok = genos.GetNumWordsPerRow() == BitGenosMatrix::ROW_ALIGN_WORDS
+		&& BitGenosMatrix::GetWordsPerRow(0) == 0 && BitGenosMatrix::GetWordsPerRow(1) == BitGenosMatrix::ROW_ALIGN_WORDS
+		&& BitGenosMatrix::GetWordsPerRow(BitGenosMatrix::INDIVS_PER_WORD * BitGenosMatrix::ROW_ALIGN_WORDS + 1)
+			== 2 * BitGenosMatrix::ROW_ALIGN_WORDS;
+	const BitGenosMatrix copy = genos;
+	for (int l = 0; l < genos.GetNumLoci(); ++l) {
+		const BitGenosMatrix::GenotypeMatrixType* ROW = copy.GetLocusRow(l);
+		is_ok = is_ok && reinterpret_cast<uintptr_t>(ROW) % 64 == 0;
+
+		// Every genotype is in its slot, the padding is zero.
+		int exp_counts[BitGenosMatrix::NUM_GENOTYPES] = { 0, 0, 0 };
+		int exp_alleles = 0;
+		for (int i = 0; i < genos.GetNumIndivs(); ++i) {
+			const int G = static_cast<int>(ROW[i / BitGenosMatrix::INDIVS_PER_WORD]
+				>> (i % BitGenosMatrix::INDIVS_PER_WORD * BitGenosMatrix::BITS_PER_GENOTYPE)) & BitGenosMatrix::GENOTYPE_MASK;
+			is_ok = is_ok && G == genos.GetGeno(i, l) && G == copy.GetGeno(i, l);
+			++exp_counts[G];
+			exp_alleles += G;
+		}
+		for (int w = 0; w < genos.GetNumWordsPerRow(); ++w)
+			is_ok = is_ok && (ROW[w] & ~(genos.GetValidMask(w) * BitGenosMatrix::GENOTYPE_MASK)) == 0;
+
+		int counts[BitGenosMatrix::NUM_GENOTYPES];
+		copy.GetLocusCounts(l, counts);
+		for (int g = 0; g < BitGenosMatrix::NUM_GENOTYPES; ++g)
+			is_ok = is_ok && counts[g] == exp_counts[g];
+		is_ok = is_ok && copy.GetLocusAlleleCount(l) == exp_alleles;
+	}
+
+	logger << "Packed genotype rows test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestMappedGenosMatrix()
+{
+	// 2 clusters of 13 individuals, so the rows end inside a byte and are padded.
+	BitGenosMatrix genos(13, 37, 2);
+	for (int i = 0; i < genos.GetNumIndivs(); ++i)
+		for (int l = 0; l < genos.GetNumLoci(); ++l)
+			genos.SetGeno(i, l, (i * 5 + l * 3 + i * l) % 3);
+
+	static const char* PATH = "mapped_genos_test.bin";
+	MappedGenosMatrix mapped_genos;
+	bool is_ok = MappedGenosMatrix::Write(PATH, genos) && MappedGenosMatrix::IsMappedFile(PATH) && mapped_genos.Open(PATH);
+	if (is_ok) {
+		is_ok = mapped_genos.GetNumIndivs() == genos.GetNumIndivs() && mapped_genos.GetNumLoci() == genos.GetNumLoci()
+			&& mapped_genos.GetNumClusters() == genos.GetNumClusters();
+		for (int l = 0; l < genos.GetNumLoci(); ++l) {
+			mapped_genos.Prefetch(l, l + 1);
+			for (int i = 0; i < genos.GetNumIndivs(); ++i)
+				is_ok = is_ok && mapped_genos.GetGeno(i, l) == genos.GetGeno(i, l);
+			mapped_genos.Release(l, l + 1);
+		}
+
+		// The copy in memory is the same matrix, padding included.
+		BitGenosMatrix copy;
+		mapped_genos.CopyTo(copy);
+		is_ok = is_ok && mapped_genos.GetVersion() == MappedGenosMatrix::VERSION && mapped_genos.Verify()
+			&& copy.GetNumIndivs() == genos.GetNumIndivs() && copy.GetNumClusters() == genos.GetNumClusters();
+		for (int l = 0; l < genos.GetNumLoci(); ++l)
+			is_ok = is_ok && memcmp(copy.GetLocusRow(l), genos.GetLocusRow(l),
+				genos.GetNumWordsPerRow() * sizeof(BitGenosMatrix::GenotypeMatrixType)) == 0;
+	}
+	mapped_genos.Close();
+
+	// A flipped genotype fails the checksum.
+	if (FILE* file = fopen(PATH, "r+b")) {
+		fseek(file, MappedGenosMatrix::HEADER_BYTES + 3, SEEK_SET);
+		const int BYTE = fgetc(file);
+		fseek(file, MappedGenosMatrix::HEADER_BYTES + 3, SEEK_SET);
+		fputc(BYTE ^ 1, file);
+		fclose(file);
+	}
+	is_ok = is_ok && mapped_genos.Open(PATH) && !mapped_genos.Verify();
+	mapped_genos.Close();
+	std::remove(PATH);
+
+	logger << "Mapped genotype test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestPlinkGenos()
+{
+	// 11 individuals, so a .bed row is 3 bytes and ends inside a byte. PLINK codes of G = 0, 1, 2.
+	static const int PLINK_CODES[] = { 0, 2, 3 };
+	static const int NUM_INDIVS = 11;
+	static const int NUM_LOCI = 9;
+	static const int MISSING_INDIV = 7;
+	static const int MISSING_LOCUS = 4;
+	std::ofstream fam("plink_test.fam"), bim("plink_test.bim");
+	for (int i = 0; i < NUM_INDIVS; ++i)
+		fam << "F I" << i << " 0 0 1 " << 1 + i % 2 << std::endl;
+	for (int l = 0; l < NUM_LOCI; ++l)
+		bim << "1 rs" << l << " 0 " << l << " A G" << std::endl;
+	fam.close();
+	bim.close();
+
+	std::ofstream bed("plink_test.bed", std::ios_base::binary);
+	bed.write(reinterpret_cast<const char*>(MappedGenosMatrix::PLINK_MAGIC), sizeof(MappedGenosMatrix::PLINK_MAGIC));
+	for (int l = 0; l < NUM_LOCI; ++l) {
+		unsigned char row[(NUM_INDIVS + 3) / 4] = {};
+		for (int i = 0; i < NUM_INDIVS; ++i) {
+			const int CODE = i == MISSING_INDIV && l == MISSING_LOCUS ? 1 : PLINK_CODES[(i + 2 * l) % 3];
+			row[i / 4] |= static_cast<unsigned char>(CODE << (i % 4 * 2));
+		}
+		bed.write(reinterpret_cast<const char*>(row), sizeof(row));
+	}
+	bed.close();
+
+	MappedGenosMatrix genos;
+	BitGenosMatrix copy;
+	std::vector<int> phenotypes;
+	bool is_ok = MappedGenosMatrix::IsMappedFile("plink_test.bed") && genos.Open("plink_test.bed") && genos.IsPlink()
+		&& genos.GetNumIndivs() == NUM_INDIVS && genos.GetNumLoci() == NUM_LOCI && genos.GetNumClusters() == 1
+		&& genos.CountMissing() == 1 && MappedGenosMatrix::ReadPlinkPhenotypes("plink_test.bed", phenotypes)
+		&& phenotypes.size() == static_cast<size_t>(NUM_INDIVS) && phenotypes[0] == 1 && phenotypes[1] == 2;
+	if (is_ok) {
+		genos.CopyTo(copy);
+		for (int l = 0; l < NUM_LOCI; ++l)
+			for (int i = 0; i < NUM_INDIVS; ++i) {
+				const int EXP_G = i == MISSING_INDIV && l == MISSING_LOCUS ? MappedGenosMatrix::MISSING_GENO : (i + 2 * l) % 3;
+				is_ok = is_ok && genos.GetGeno(i, l) == EXP_G && copy.GetGeno(i, l) == EXP_G;
+			}
+	}
+	genos.Close();
+	std::remove("plink_test.bed");
+	std::remove("plink_test.bim");
+	std::remove("plink_test.fam");
+
+	logger << "PLINK genotype test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestMissingGenos()
+{
+	// 2 clusters of 19 individuals; individual i misses locus l if (i + l) % 5 == 0, written as '9', '-' or 'N'.
+	static const int NUM_INDIVS = 19;
+	static const int NUM_CLUSTERS = 2;
+	static const int NUM_LOCI = 23;
+	static const char MISSING_CHARS[] = { '9', '-', 'N' };
+	static const char* TEXT_PATH = "missing_genos_test.txt";
+	static const char* PACKED_PATH = "missing_genos_test.bin";
+	auto ExpGeno = [](int i, int l) { return (i + l) % 5 == 0 ? BitGenosMatrix::MISSING_GENO : (i * 3 + l) % 3; };
+
+	std::ofstream text(TEXT_PATH);
+	text << "NUM_INDIVS: " << NUM_INDIVS << std::endl << "NUM_LOCI: " << NUM_LOCI << std::endl
+		<< "NUM_CLUSTERS: " << NUM_CLUSTERS << std::endl << std::endl;
+	for (int i = 0; i < NUM_INDIVS * NUM_CLUSTERS; ++i) {
+		for (int l = 0; l < NUM_LOCI; ++l) {
+			const int G = ExpGeno(i, l);
+			text << (G == BitGenosMatrix::MISSING_GENO ? MISSING_CHARS[l % 3] : static_cast<char>('0' + G));
+		}
+		text << std::endl;
+	}
+	text.close();
+
+	ThreadPool pool(3);
+	BitGenosMatrix genos;
+	MappedGenosMatrix packed;
+	bool is_ok = TextGenosFile::ReadFastStructure(TEXT_PATH, genos, pool) && MappedGenosMatrix::Write(PACKED_PATH, genos) && packed.Open(PACKED_PATH);
+	std::vector<int> exp_locus(NUM_LOCI, 0), exp_indiv(NUM_INDIVS * NUM_CLUSTERS, 0);
+	for (int l = 0; is_ok && l < NUM_LOCI; ++l) {
+		int exp_counts[BitGenosMatrix::NUM_GENOTYPES] = { 0, 0, 0 };
+		int exp_alleles = 0;
+		for (int i = 0; i < genos.GetNumIndivs(); ++i) {
+			const int G = ExpGeno(i, l);
+			is_ok = is_ok && genos.GetGeno(i, l) == G && packed.GetGeno(i, l) == G;
+			if (G == BitGenosMatrix::MISSING_GENO) {
+				++exp_locus[l];
+				++exp_indiv[i];
+			} else {
+				++exp_counts[G];
+				exp_alleles += G;
+			}
+		}
+
+		// Missing calls are in no genotype class.
+		int counts[BitGenosMatrix::NUM_GENOTYPES];
+		BitGenosMatrix::LocusClasses classes;
+		genos.GetLocusCounts(l, counts);
+		genos.GetLocusClasses(l, classes);
+		for (int g = 0; g < BitGenosMatrix::NUM_GENOTYPES; ++g)
+			is_ok = is_ok && counts[g] == exp_counts[g] && classes.GetCount(g) == exp_counts[g];
+		is_ok = is_ok && genos.GetLocusAlleleCount(l) == exp_alleles;
+	}
+
+	std::vector<int> locus_missing, indiv_missing, packed_locus_missing, packed_indiv_missing;
+	if (is_ok) {
+		genos.GetMissingCounts(locus_missing, indiv_missing);
+		packed.GetMissingCounts(packed_locus_missing, packed_indiv_missing);
+	}
+	is_ok = is_ok && locus_missing == exp_locus && indiv_missing == exp_indiv
+		&& packed_locus_missing == exp_locus && packed_indiv_missing == exp_indiv
+		&& packed.CountMissing() == std::accumulate(exp_locus.begin(), exp_locus.end(), static_cast<int64_t>(0));
+	packed.Close();
+	std::remove(TEXT_PATH);
+	std::remove(PACKED_PATH);
+
+	logger << "Missing genotype test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestTextGenos()
+{
+	// 3 clusters of 23 individuals, so the last task owns a partial word. Rows are written plain,
+	// with separators, and wrapped over two lines; the last two are read as one stream.
+	static const int NUM_INDIVS = 23;
+	static const int NUM_CLUSTERS = 3;
+	static const int NUM_LOCI = 41;
+	static const char* PATH = "text_genos_test.txt";
+	auto ExpGeno = [](int i, int l) { return (i * l) % 7 == 3 ? BitGenosMatrix::MISSING_GENO : (i + 2 * l + i * l) % 3; };
+	auto WriteFile = [&](int style, int num_rows) {
+		std::ofstream text(PATH, std::ios_base::binary);
+		text << "NUM_INDIVS: " << NUM_INDIVS << "\r\nNUM_LOCI: " << NUM_LOCI << "\r\nNUM_CLUSTERS: " << NUM_CLUSTERS << "\r\n\r\n";
+		for (int i = 0; i < num_rows; ++i) {
+			for (int l = 0; l < NUM_LOCI; ++l) {
+				const int G = ExpGeno(i, l);
+				text << (G == BitGenosMatrix::MISSING_GENO ? '9' : static_cast<char>('0' + G));
+				if (style == 1 && i % 2 == 0)
+					text << ' ';
+				if (style == 2 && l == NUM_LOCI / 2)
+					text << '\n';
+			}
+			text << "\r\n";
+		}
+	};
+
+	ThreadPool pool(4);
+	bool is_ok = true;
+	for (int style = 0; style < 3; ++style) {
+		WriteFile(style, NUM_INDIVS * NUM_CLUSTERS);
+		BitGenosMatrix genos;
+		is_ok = is_ok && TextGenosFile::ReadFastStructure(PATH, genos, pool) && genos.GetNumIndivs() == NUM_INDIVS * NUM_CLUSTERS
+			&& genos.GetNumLoci() == NUM_LOCI && genos.GetNumClusters() == NUM_CLUSTERS;
+		for (int i = 0; is_ok && i < genos.GetNumIndivs(); ++i)
+			for (int l = 0; l < NUM_LOCI; ++l)
+				is_ok = is_ok && genos.GetGeno(i, l) == ExpGeno(i, l);
+	}
+
+	// A missing row fails, so does a row short of a genotype.
+	BitGenosMatrix genos;
+	WriteFile(0, NUM_INDIVS * NUM_CLUSTERS - 1);
+	is_ok = is_ok && !TextGenosFile::ReadFastStructure(PATH, genos, pool);
+	{
+		std::ofstream text(PATH);
+		text << "NUM_INDIVS: 2\nNUM_LOCI: 3\nNUM_CLUSTERS: 1\n\n012\n0 1\n";
+	}
+	is_ok = is_ok && !TextGenosFile::ReadFastStructure(PATH, genos, pool);
+
+	// A labeled MySTRUCTURE input file, one row per chromosome.
+	{
+		std::ofstream text(PATH);
+		text << "3 2 4\n2 100 10\n";
+		for (int i = 0; i < 3; ++i)
+			for (int c = 0; c < 2; ++c) {
+				text << (i % 2) << ' ';
+				for (int l = 0; l < 4; ++l)
+					text << (i + c + l) % 3 << (l % 2 ? " " : "");
+				text << std::endl;
+			}
+	}
+	Params params;
+	is_ok = is_ok && params.InitExhMotahari(PATH) && params.GetNumIndividuals() == 3 && params.GetNumChromosomes() == 2
+		&& params.GetNumLoci() == 4 && params.GetNumIterations() == 100 && params.GetNumBurnins() == 10;
+	for (int i = 0; is_ok && i < 3; ++i) {
+		is_ok = is_ok && params.GetLabel(i) == i % 2;
+		for (int c = 0; c < 2; ++c)
+			for (int l = 0; l < 4; ++l)
+				is_ok = is_ok && params.GetAllele(i, c, l) == (i + c + l) % 3;
+	}
+	std::remove(PATH);
+
+	logger << "Text genotype loader test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestBackgroundFileWriter()
+{
+	static const char* PATH = "file_writer_test.bin";
+	std::vector<char> data(100000), expected;
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = static_cast<char>(i * 31);
+	expected = data;
+
+	// The buffer is taken over, and a second write is refused while the first one runs.
+	BackgroundFileWriter writer;
+	std::vector<char> other(10, 'x'), read;
+	bool is_ok = writer.TryWrite(PATH, data) && data.empty();
+	if (writer.IsBusy())
+		is_ok = is_ok && !writer.TryWrite(PATH, other) && other.size() == 10;
+	is_ok = is_ok && writer.Wait() && BackgroundFileWriter::ReadFile(PATH, read) && read == expected;
+
+	// An atomic rewrite replaces the whole content.
+	is_ok = is_ok && BackgroundFileWriter::WriteAtomic(PATH, other) && BackgroundFileWriter::ReadFile(PATH, read) && read == other;
+	std::remove(PATH);
+
+	logger << "Background file writer test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestMatchClusters()
+{
+	// The Hungarian matching finds the best sum of all permutations, also of rectangular matrices.
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> count(0, 20);
+	bool is_ok = true;
+	for (int t = 0; t < 200 && is_ok; ++t) {
+		const int NUM_ROWS = 1 + t % 6;
+		const int NUM_COLS = 1 + t / 6 % 6;
+		std::vector<std::vector<double>> weights(NUM_ROWS, std::vector<double>(NUM_COLS));
+		for (auto& row : weights)
+			for (double& w : row)
+				w = count(rng);
+
+		std::vector<int> perm(std::max(NUM_ROWS, NUM_COLS));
+		std::iota(perm.begin(), perm.end(), 0);
+		double best = 0.0;
+		do {
+			double sum = 0.0;
+			for (int r = 0; r < NUM_ROWS; ++r)
+				sum += perm[r] < NUM_COLS ? weights[r][perm[r]] : 0.0;
+			best = std::max(best, sum);
+		} while (std::next_permutation(perm.begin(), perm.end()));
+
+		std::vector<int> mapping;
+		const double SUM = MatchClusters(weights, mapping);
+		std::vector<bool> is_used(NUM_COLS, false);
+		double mapped_sum = 0.0;
+		for (int r = 0; r < NUM_ROWS; ++r) {
+			if (mapping[r] < 0)
+				continue;
+			is_ok = is_ok && !is_used[mapping[r]];
+			is_used[mapping[r]] = true;
+			mapped_sum += weights[r][mapping[r]];
+		}
+		is_ok = is_ok && SUM == best && mapped_sum == best
+			&& std::count(mapping.begin(), mapping.end(), -1) == std::max(0, NUM_ROWS - NUM_COLS);
+	}
+
+	// A shuffled labelling of K = 50 clusters, out of reach of the permutations, is recovered.
+	const int K = 50;
+	std::vector<int> labels(K), true_clusters, found_clusters, mapping;
+	std::iota(labels.begin(), labels.end(), 0);
+	std::shuffle(labels.begin(), labels.end(), rng);
+	for (int k = 0; k < K; ++k)
+		for (int i = 0; i < 10; ++i) {
+			true_clusters.push_back(k);
+			found_clusters.push_back(i == 0 ? (labels[k] + 1) % K : labels[k]);
+		}
+	std::vector<std::vector<double>> confusion;
+	CountConfusion(true_clusters, found_clusters, K, K, confusion);
+	is_ok = is_ok && confusion[3][labels[3]] == 9 && MatchClusters(confusion, mapping) == 9 * K && mapping == labels;
+
+	logger << "Cluster matching test " << (is_ok ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
+static void TestSimdMathTails()
+{
+	// An array of GetSimdLanes() + 1 elements runs one vector step and one scalar tail element. Every element must
+	// equal the per-element call, whichever path it took, or the expectations depend on how the loci are split.
+	std::mt19937_64 rng(11);
+	std::uniform_real_distribution<double> arg(0.01, 20.0);
+	const int NUM_ELEMS = GetSimdLanes() + 1;
+	std::vector<double> x(NUM_ELEMS), dg(NUM_ELEMS), lg(NUM_ELEMS);
+	int num_diffs = 0;
+	for (int t = 0; t < 100000; ++t) {
+		for (double& v : x)
+			v = arg(rng);
+		DigammaArray(x.data(), dg.data(), NUM_ELEMS);
+		LogGammaArray(x.data(), lg.data(), NUM_ELEMS);
+		for (int i = 0; i < NUM_ELEMS; ++i)
+			num_diffs += (dg[i] != Digamma(x[i])) + (lg[i] != LogGamma(x[i]));
+	}
+
+	logger << "SIMD math tail test (" << GetSimdInstructionSet() << ", " << num_diffs << " differences) "
+		<< (num_diffs == 0 ? "PASSED" : "FAILED") << '!' << std::endl;
+}
+
 static void TestGenosMatrixFromFile()
 {
+	ThreadPool pool;
 	BitGenosMatrix genos;
-	if (!genos.ReadFromTextFile("F:\\C++\\fastStructure\\TestStr\\Cpp\\Test14\\cpp_dise_genos_K2_L10000_D5_N500.str-faststr.txt")) {
+	if (!TextGenosFile::ReadFastStructure("F:\\C++\\fastStructure\\TestStr\\Cpp\\Test14\\cpp_dise_genos_K2_L10000_D5_N500.str-faststr.txt", genos, pool)) {
 		logger << "Could not open genotype text file!" << std::endl;
 		return;
 	}
@@ -202,7 +635,16 @@ int main()
 
 	//TestFastMakeCombinations();
 	TestGenosMatrix();
+	TestGenosLocusClasses();
+	TestPackedGenosRows();
+	TestMappedGenosMatrix();
+	TestPlinkGenos();
+	TestMissingGenos();
+	TestTextGenos();
+	TestBackgroundFileWriter();
 	TestGenosMatrixFromFile();
+	TestMatchClusters();
+	TestSimdMathTails();
 
 	logger << "End : " << Time << std::endl << std::endl;
 	logger << " [OK] TEST PASSED!" << std::endl << std::endl;
@@ -1,10 +1,15 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 
 #include "asa147.hpp"
 #include "libs.h"
+#include "mapped-genos.h"
+#include "text-genos.h"
+#include "thread-pool.h"
 
 //#define READ_K_1
 //#define READ_K_2
@@ -22,17 +27,29 @@ typedef std::vector<unsigned char> Labels;
 
 
 
+inline static int GetNumIndivs(const Indivs& indivs) { return static_cast<int>(indivs.size()); }
+inline static int GetNumLoci(const Indivs& indivs) { return static_cast<int>(indivs[0].size()); }
+inline static int GetGeno(const Indivs& indivs, int i, int l) { return indivs[i][l]; }
+
+inline static int GetNumIndivs(const MappedGenosMatrix& genos) { return genos.GetNumIndivs(); }
+inline static int GetNumLoci(const MappedGenosMatrix& genos) { return genos.GetNumLoci(); }
+inline static int GetGeno(const MappedGenosMatrix& genos, int i, int l) { return genos.GetGeno(i, l); }
+
+
+
+/// Reads the -faststr.txt rows on all threads; a missing call is MISSING_GENO, which PrintPVals leaves out.
 static bool ReadGenos(const char* genos_path, Indivs& indivs)
 {
-	std::ifstream infile(genos_path);
-	if (!infile.is_open()) {
+	ThreadPool pool;
+	TextGenosFile text;
+	if (!text.Open(genos_path, 6, pool)) {
 		std::cout << "Could not open genotype `" << genos_path << "' file!" << std::endl;
 		return false;
 	}
 
-	std::string line;
-	int num_indivs, num_loci, num_clusters;
-	infile >> line >> num_indivs >> line >> num_loci >> line >> num_clusters;
+	const int num_indivs = atoi(text.GetHeader()[1].c_str());
+	const int num_loci = atoi(text.GetHeader()[3].c_str());
+	const int num_clusters = atoi(text.GetHeader()[5].c_str());
 
 #if defined FULL_OUTPUT
 	std::cout << "NumIndiv:" << num_indivs << std::endl;
@@ -46,33 +63,36 @@ static bool ReadGenos(const char* genos_path, Indivs& indivs)
 	indivs.resize(num_indivs * num_clusters);
 #endif
 
-	int i = 0;
 #if defined READ_K_2
-	int num_first = 0;
-#endif
-	while (std::getline(infile, line)) {
-		if (!line.size())
-			continue;
-
-#if defined READ_K_2
-		if (num_first < num_indivs) {
-			++num_first;
-			continue;
-		}
-#endif
-
-		indivs[i].resize(num_loci);
-		for (int l = 0; l < num_loci; ++l)
-			indivs[i][l] = line[l] - 0x30;
-
-		++i;
-#if defined READ_K_1
-		if (i >= num_indivs)
-			break;
+	const int FIRST_ROW = num_indivs;
+#else
+	const int FIRST_ROW = 0;
 #endif
 
+	auto ReadRow = [&](const char* pos, const char* end, Chrom& chrom) {
+		chrom.resize(num_loci);
+		return TextGenosFile::ScanRow(pos, end, num_loci, [&](int l, char c) { chrom[l] = TextGenosFile::GetGeno(c); });
+	};
+
+	if (text.GetNumRows() != num_indivs * num_clusters) {
+		Chrom skipped;
+		const char* pos = text.GetBodyBegin();
+		for (int r = 0; r < FIRST_ROW + GetNumIndivs(indivs) && pos != nullptr; ++r)
+			pos = ReadRow(pos, text.GetBodyEnd(), r < FIRST_ROW ? skipped : indivs[r - FIRST_ROW]);
+		if (pos == nullptr)
+			std::cout << "Genotype `" << genos_path << "' file is truncated!" << std::endl;
+		return pos != nullptr;
 	}
-	return true;
+
+	std::atomic<bool> is_ok(true);
+	pool.ParallelFor(0, GetNumIndivs(indivs), [&](int first_indiv, int last_indiv) {
+		for (int i = first_indiv; i < last_indiv; ++i)
+			if (ReadRow(text.GetRowBegin(FIRST_ROW + i), text.GetRowEnd(FIRST_ROW + i), indivs[i]) == nullptr)
+				is_ok = false;
+	});
+	if (!is_ok)
+		std::cout << "Genotype `" << genos_path << "' file has short rows!" << std::endl;
+	return is_ok;
 }
 
 static bool ReadLabels(const char* label_path, Labels& lbls, int& num_cases, int& num_controls)
@@ -112,6 +132,29 @@ static bool ReadLabels(const char* label_path, Labels& lbls, int& num_cases, int
 
 
 
+/// Reads the genotypes of a PLINK fileset in place and the case / control labels from the phenotypes of its .fam.
+static bool ReadPlink(const char* bed_path, MappedGenosMatrix& genos, Labels& lbls, int& num_cases, int& num_controls)
+{
+	std::vector<int> phenotypes;
+	if (!genos.Open(bed_path) || !genos.IsPlink() || !MappedGenosMatrix::ReadPlinkPhenotypes(bed_path, phenotypes)) {
+		std::cout << "Could not open PLINK `" << bed_path << "' fileset!" << std::endl;
+		return false;
+	}
+
+	num_cases = num_controls = 0;
+	for (const int PHENO : phenotypes) {
+		const unsigned char LBL = PHENO == 2 ? 1 : 0;
+		if (LBL)
+			++num_cases;
+		else
+			++num_controls;
+		lbls.push_back(LBL);
+	}
+	return true;
+}
+
+
+
 double gammainc(double a, double x)
 {
 	int e;
@@ -159,24 +202,12 @@ static double GetPVal(int* cases, int* contr, int num_indivs, int num_cases, int
 	return -log(RES);
 }
 
-int main(int argc, char** argv)
+/// Genos is Indivs or MappedGenosMatrix; individuals with a missing call are left out of a locus.
+template <typename Genos>
+static void PrintPVals(const Genos& genos, const Labels& labels, int num_cases, int num_controls)
 {
-#if defined FULL_OUTPUT
-	std::cout << GetCTime() << "Start contingency . . ." << std::endl;
-#endif
-
-	Indivs indivs;
-	if (!ReadGenos("cpp_dise_genos_K2_L10000_D5_N500.str-faststr.txt", indivs))
-		return 1;
-
-	const int NUM_INDIVS = static_cast<int>(indivs.size());
-	const int NUM_LOCI = static_cast<int>(indivs[0].size());
-
-	Labels labels;
-	int num_cases, num_controls;
-	if (!ReadLabels("cpp_dise_label_K2_L10000_D5_N500.txt", labels, num_cases, num_controls))
-		return 2;
-
+	const int NUM_INDIVS = GetNumIndivs(genos);
+	const int NUM_LOCI = GetNumLoci(genos);
 
 	int cases[NUM_ALLELES];
 	int contr[NUM_ALLELES];
@@ -184,7 +215,9 @@ int main(int argc, char** argv)
 		memset(&cases, 0, sizeof(cases[0]) * NUM_ALLELES);
 		memset(&contr, 0, sizeof(cases[0]) * NUM_ALLELES);
 		for (int i = 0; i < NUM_INDIVS; ++i) {
-			const int IDX = static_cast<int>(indivs[i][l]);
+			const int IDX = GetGeno(genos, i, l);
+			if (IDX >= NUM_ALLELES)
+				continue;
 			if (labels[i])
 				++cases[IDX];
 			else
@@ -200,6 +233,34 @@ int main(int argc, char** argv)
 		std::cout << ((l + 1) * 0.1) << '\t' << p_val << std::endl;
 #endif
 	}
+}
+
+int main(int argc, char** argv)
+{
+#if defined FULL_OUTPUT
+	std::cout << GetCTime() << "Start contingency . . ." << std::endl;
+#endif
+
+	Labels labels;
+	int num_cases, num_controls;
+
+	// contingency <bed-file>: a PLINK fileset, labels from the phenotypes of its .fam.
+	if (argc > 1) {
+		MappedGenosMatrix genos;
+		if (!ReadPlink(argv[1], genos, labels, num_cases, num_controls))
+			return 1;
+		PrintPVals(genos, labels, num_cases, num_controls);
+		return 0;
+	}
+
+	Indivs indivs;
+	if (!ReadGenos("cpp_dise_genos_K2_L10000_D5_N500.str-faststr.txt", indivs))
+		return 1;
+
+	if (!ReadLabels("cpp_dise_label_K2_L10000_D5_N500.txt", labels, num_cases, num_controls))
+		return 2;
+
+	PrintPVals(indivs, labels, num_cases, num_controls);
 	return 0;
 }
 